@@ -14,9 +14,13 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <ctype.h>
+#include <errno.h>
 #include <inttypes.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "humane.h"
 
@@ -53,6 +57,48 @@ char * humane_bytes(humane_t *humane, uint64_t bytes)
 }
 
 
+/* Parse a "human-readable" size like "16M", "4KiB" or "512" into *res, roughly the inverse of humane_bytes().
+ * Units are always powers of 1024, an optional "B" or "iB" may follow the unit letter.
+ * Returns < 0 on error, 0 on success.
+ */
+int humane_parse_bytes(const char *str, uint64_t *res)
+{
+	static const char	units[] = "BKMGTPE";
+	const char		*unit;
+	uint64_t		n;
+	char			*end;
+
+	errno = 0;
+	n = strtoull(str, &end, 10);
+	if (errno || end == str)
+		return -EINVAL;
+
+	if (*end) {
+		unit = strchr(units, toupper(*end));
+		if (!unit || !*unit)
+			return -EINVAL;
+
+		end++;
+		if (*unit != 'B' && strcmp(end, "") && strcmp(end, "B") && strcmp(end, "iB"))
+			return -EINVAL;
+
+		if (*unit == 'B' && *end)
+			return -EINVAL;
+
+		for (int i = 0; i < unit - units; i++) {
+			if (n > UINT64_MAX / 1024)
+				return -ERANGE;
+
+			n *= 1024;
+		}
+	}
+
+	*res = n;
+
+	return 0;
+}
+
+
 #if 0
 /* TODO: when/if unit tests become a thing in this tree, turn this into one of them and assert the
  * stringified "humane" outputs match expectations.
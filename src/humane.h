@@ -8,5 +8,6 @@ typedef struct humane_t {
 } humane_t;
 
 char * humane_bytes(humane_t *humane, uint64_t bytes);
+int humane_parse_bytes(const char *str, uint64_t *res);
 
 #endif
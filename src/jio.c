@@ -14,11 +14,16 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <errno.h>
+#include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <iou.h>
 
+#include "humane.h"
+#include "journals.h"
 #include "reclaim-tail-waste.h"
 #include "report-entry-arrays.h"
 #include "report-layout.h"
@@ -34,13 +39,108 @@
 
 /* XXX: This is a WIP experiment, use at your own risk! XXX */
 
+#define OPTION(_arg, _name)	(!strncmp(_arg, _name "=", sizeof(_name)))
+#define OPTION_VALUE(_arg, _name)	(_arg + sizeof(_name))
+
+/* parse str as an unsigned integer of at least min into *res, returns < 0 on error */
+static int parse_unsigned(const char *str, unsigned min, unsigned *res)
+{
+	unsigned long	v;
+	char		*end;
+
+	errno = 0;
+	v = strtoul(str, &end, 10);
+	if (errno || end == str || *end || v < min || v > UINT_MAX)
+		return -EINVAL;
+
+	*res = v;
+
+	return 0;
+}
+
+
+/* parse a global option preceding the subcommand, returns < 0 on error */
+static int parse_option(const char *arg)
+{
+	if (OPTION(arg, "--backend")) {
+		const char	*backend = OPTION_VALUE(arg, "--backend");
+
+		if (!strcmp(backend, "iou"))
+			journals_config.backend = JOURNAL_BACKEND_IOU;
+		else if (!strcmp(backend, "mmap"))
+			journals_config.backend = JOURNAL_BACKEND_MMAP;
+		else
+			return -EINVAL;
+
+		return 0;
+	}
+
+	if (OPTION(arg, "--cache"))
+		return humane_parse_bytes(OPTION_VALUE(arg, "--cache"), &journals_config.cache_size);
+
+	if (OPTION(arg, "--readahead"))
+		return humane_parse_bytes(OPTION_VALUE(arg, "--readahead"), &journals_config.readahead);
+
+	if (OPTION(arg, "--path")) {
+		char	**paths;
+
+		paths = realloc(journals_config.paths, sizeof(*paths) * (journals_config.n_paths + 1));
+		if (!paths)
+			return -ENOMEM;
+
+		paths[journals_config.n_paths++] = (char *)OPTION_VALUE(arg, "--path");
+		journals_config.paths = paths;
+
+		return 0;
+	}
+
+	if (OPTION(arg, "--window"))
+		return parse_unsigned(OPTION_VALUE(arg, "--window"), 1, &journals_config.window);
+
+	if (OPTION(arg, "--queue-depth"))
+		return parse_unsigned(OPTION_VALUE(arg, "--queue-depth"), 0, &journals_config.queue_depth);
+
+	if (OPTION(arg, "--device-queue-depth"))
+		return parse_unsigned(OPTION_VALUE(arg, "--device-queue-depth"), 0, &journals_config.device_queue_depth);
+
+	if (OPTION(arg, "--device-streams"))
+		return parse_unsigned(OPTION_VALUE(arg, "--device-streams"), 0, &journals_config.device_streams);
+
+	if (OPTION(arg, "--jobs"))
+		return parse_unsigned(OPTION_VALUE(arg, "--jobs"), 1, &journals_config.jobs);
+
+	if (OPTION(arg, "--splits"))
+		return parse_unsigned(OPTION_VALUE(arg, "--splits"), 1, &journals_config.splits);
+
+	if (!strcmp(arg, "--cache-neutral")) {
+		journals_config.cache_neutral = 1;
+
+		return 0;
+	}
+
+	return -EINVAL;
+}
+
+
 int main(int argc, char *argv[])
 {
 	iou_t	*iou;
 	int	r;
 
+	/* consume global options preceding the subcommand, keeping argv[0] in place */
+	while (argc > 1 && !strncmp(argv[1], "--", 2)) {
+		if (parse_option(argv[1]) < 0) {
+			fprintf(stderr, "Unsupported option: \"%s\"\n", argv[1]);
+			return 1;
+		}
+
+		argv[1] = argv[0];
+		argv++;
+		argc--;
+	}
+
 	if (argc < 2) {
-		printf("Usage: %s {help,reclaim,report,verify} [subcommand-args]\n", argv[0]);
+		printf("Usage: %s [options] {help,reclaim,report,verify} [subcommand-args]\n", argv[0]);
 		return 0;
 	}
 
@@ -64,6 +164,32 @@ int main(int argc, char *argv[])
 			"         tail-waste   report extra space allocated onto tails\n"
 			" version              print jio version\n"
 			"\n"
+			" options, placed before the subcommand:\n"
+			"  --backend=iou|mmap  read journals via io_uring (default) or mmap\n"
+			"  --cache=SIZE        size of the buffer cache shared by all journals, default 8M\n"
+			"  --readahead=SIZE    keep SIZE bytes (e.g. 8M) of reads in flight ahead of\n"
+			"                      sequential object scans, default 0 (disabled)\n"
+			"  --cache-neutral     read journals with O_DIRECT, or drop scanned archives\n"
+			"                      from the page cache where O_DIRECT is unsupported\n"
+			"  --path=PATH         open the journals found at PATH instead of the system's,\n"
+			"                      a directory, journal file, or glob, may be repeated\n"
+			"  --window=N          keep at most N journals open at once, default 256 or\n"
+			"                      half of RLIMIT_NOFILE, whichever is smaller\n"
+			"  --queue-depth=N     keep at most N journal reads in flight, default 64,\n"
+			"                      0 for unlimited\n"
+			"  --device-queue-depth=N\n"
+			"                      keep at most N journal reads in flight per device,\n"
+			"                      default 0 (unlimited)\n"
+			"  --device-streams=N  scan at most N journals at once per device, default 0\n"
+			"                      for 2 on rotational devices and unlimited otherwise\n"
+			"  --jobs=N            scan journals from N threads, default 1, each with its\n"
+			"                      own cache and queue depth, sharing the window, devices\n"
+			"                      with per-device limits (rotational ones by default)\n"
+			"                      are each scanned by one job so the limits hold\n"
+			"  --splits=N          scan large journals as up to N ranges at once, split\n"
+			"                      where objects are known to start, default 1, only\n"
+			"                      report usage splits journals so far\n"
+			"\n"
 		);
 		return 0;
 	} else if (!strcmp(argv[1], "license")) {
@@ -0,0 +1,107 @@
+/*
+ *  Copyright (C) 2020 - Vito Caputo - <vcaputo@pengaru.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License version 3 as published
+ *  by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <iou.h>
+
+#include "jobs.h"
+#include "journals.h"
+
+/* Runs a subcommand's work as n_jobs jobs, each on its own thread with its
+ * own iou, so nothing driven from one iou is ever touched by another thread.
+ * The journals themselves are divvied up among the jobs by journals_open()
+ * and journals_for_each(), what's left to the subcommand is keeping a
+ * separate arg per job for its stats, and merging them once jobs_run()
+ * returns.
+ */
+
+typedef struct job_t {
+	pthread_t	thread;
+	int		(*fn)(iou_t *iou, void *arg);
+	void		*arg;
+	int		r;
+} job_t;
+
+
+static void * job_thread(void *arg)
+{
+	job_t	*job = arg;
+	iou_t	*iou;
+
+	iou = iou_new(8);
+	if (!iou) {
+		job->r = -ENOMEM;
+		return NULL;
+	}
+
+	job->r = job->fn(iou, job->arg);
+	iou_free(iou);
+	journals_pool_free();
+
+	return NULL;
+}
+
+
+/* Run job(iou, arg) for n_jobs args of arg_size bytes each at args, the
+ * first on the calling thread with iou, the rest on threads of their own
+ * with their own iou.  job is expected to run its iou until its work is
+ * done, the first error returned by any job is returned once all are done.
+ */
+int jobs_run(iou_t *iou, unsigned n_jobs, int (*job)(iou_t *iou, void *arg), void *args, size_t arg_size)
+{
+	job_t		*jobs;
+	unsigned	n_started;
+	int		r;
+
+	assert(iou);
+	assert(job);
+
+	if (n_jobs <= 1)
+		return job(iou, args);
+
+	jobs = calloc(n_jobs, sizeof(*jobs));
+	if (!jobs)
+		return -ENOMEM;
+
+	for (n_started = 1; n_started < n_jobs; n_started++) {
+		job_t	*j = &jobs[n_started];
+
+		j->fn = job;
+		j->arg = args ? (uint8_t *)args + arg_size * n_started : NULL;
+		r = pthread_create(&j->thread, NULL, job_thread, j);
+		if (r) {
+			/* carry on with the jobs started, they'll pick up the slack */
+			break;
+		}
+	}
+
+	r = job(iou, args);
+
+	for (unsigned i = 1; i < n_started; i++) {
+		pthread_join(jobs[i].thread, NULL);
+		if (!r)
+			r = jobs[i].r;
+	}
+
+	free(jobs);
+
+	return r;
+}
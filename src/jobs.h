@@ -0,0 +1,10 @@
+#ifndef _JIO_JOBS_H
+#define _JIO_JOBS_H
+
+#include <stddef.h>
+
+typedef struct iou_t iou_t;
+
+int jobs_run(iou_t *iou, unsigned n_jobs, int (*job)(iou_t *iou, void *arg), void *args, size_t arg_size);
+
+#endif
@@ -17,12 +17,23 @@
 #include <assert.h>
 #include <dirent.h>
 #include <fcntl.h>
+#include <glob.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <linux/fiemap.h>
+#include <linux/fs.h>
 #include <liburing.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include <iou.h>
@@ -35,9 +46,52 @@
 
 
 #define PERSISTENT_PATH	"/var/log/journal"
+#define VOLATILE_PATH	"/run/log/journal"
 
-#define JOURNAL_BUF_SIZE	8192
-#define JOURNAL_BUF_CNT		8
+#define JOURNALS_ALLOC_MIN	16
+#define JOURNALS_WINDOW_DEFAULT	256
+
+#define JOURNAL_BLOCK_MAX	(64 * 1024)
+#define JOURNAL_CACHE_DEFAULT	(8 * 1024 * 1024)
+#define JOURNAL_CACHE_MIN_BUFS	64
+
+#define JOURNAL_LARGE_MIN_SIZE	(128 * 1024)
+#define JOURNAL_LARGE_N_CLASSES	4
+#define JOURNAL_LARGE_CLASS_MEM	(2 * 1024 * 1024)
+
+#define JOURNAL_RA_CHUNK_SIZE	(1024 * 1024)
+#define JOURNAL_RA_ALIGN	4096
+#define JOURNAL_RA_MIN_CHUNKS	2
+
+#define JOURNAL_DISPATCH_DEPTH	128
+
+#define JOURNAL_BATCH_SIZE	(1024 * 1024)	/* region borrowed per journal_iter_object_batches() step */
+#define JOURNAL_SPLIT_MIN_SIZE	(64 * 1024 * 1024)	/* smallest range journal_get_split_points() splits off */
+#define JOURNAL_SPLIT_CANDIDATES	64
+
+#define JOURNAL_QUEUE_DEPTH_DEFAULT	64
+#define JOURNAL_IO_MERGE_MAX	16		/* ios issued as one readv at most */
+#define JOURNAL_IO_MERGE_SIZE	(1024 * 1024)	/* bytes read by a merged readv at most */
+#define JOURNAL_ROTATIONAL_STREAMS	2
+
+
+#define JOURNAL_HASH_CHUNK_BUCKETS	4096	/* 64KiB of HashItems */
+#define JOURNAL_HASH_CHAINS_DEFAULT	16
+
+#define JOURNAL_HEADER_SIZE_MIN	ALIGN64(offsetof(Header, n_data))
+
+#define JOURNAL_DIRECT_ALIGN	4096
+#define JOURNAL_DONTNEED_CHUNK	(4 * 1024 * 1024)
+
+/* Journal files are little-endian, so what's loaded only needs normalizing
+ * on big-endian hosts.  Elsewhere le64toh() is a no-op, but the loops over
+ * hash table and array items applying it would still walk them all.
+ */
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+#define JOURNAL_HOST_IS_LE	1
+#else
+#define JOURNAL_HOST_IS_LE	0
+#endif
 
 #ifndef container_of
 #define container_of(_ptr, _type, _member) \
@@ -45,390 +99,2802 @@
 #endif
 
 
+typedef struct _journal_t _journal_t;
 typedef struct journal_buf_t journal_buf_t;
+typedef struct journal_dev_t journal_dev_t;
+typedef struct journal_io_t journal_io_t;
+typedef struct journal_large_class_t journal_large_class_t;
+typedef struct journal_large_t journal_large_t;
+typedef struct journal_ra_t journal_ra_t;
+typedef struct journal_waiter_t journal_waiter_t;
+
+/* a read or borrow waiting on a pending cache buf or readahead chunk,
+ * replayed via journal_read() or journal_borrow() when the fill completes
+ */
+struct journal_waiter_t {
+	journal_waiter_t	*next;
+	uint64_t		offset, length;
+	void			*dest;
+	journal_view_t		*view;
+	thunk_t			*closure;
+};
+
+/* An I/O on behalf of a journal.  These are queued on the journal's device
+ * and only submitted to the ring once admitted under the configured queue
+ * depths, closure is dispatched on completion with the result in io->result.
+ * Reads queued back to back in a journal are admitted together, chained
+ * from the first via merged and issued as a single readv.
+ */
+struct journal_io_t {
+	journal_io_t		*next;
+	journal_io_t		*merged;	/* reads following this one in the same readv */
+	_journal_t		*journal;
+	uint8_t			opcode;		/* IORING_OP_{READ,READ_FIXED,FADVISE} */
+	unsigned		buf_index;	/* IORING_OP_READ_FIXED */
+	int			advice;		/* IORING_OP_FADVISE */
+	void			*buf;
+	uint64_t		offset, length;
+	uint64_t		key;		/* elevator position, see journal_io_key() */
+	int			result;
+	thunk_t			*closure;
+	struct iovec		iovecs[JOURNAL_IO_MERGE_MAX];	/* of the readv, when merged */
+};
+
+/* Admission state of a device, shared by the journals residing on it.
+ * Queued ios are kept in elevator order, and only so many journals are
+ * scanned at once per device, the rest aren't even claimed for opening
+ * until a stream frees up, see journals_claim().
+ */
+struct journal_dev_t {
+	journal_dev_t		*next;
+	dev_t			dev;
+	unsigned		rotational:1;
+	unsigned		n_inflight, n_streams, max_streams;
+	uint64_t		head;		/* elevator position of the last admitted io */
+	journal_io_t		*queue;
+};
 
+/* a block of some journal in the shared buffer cache */
 struct journal_buf_t {
-	journal_buf_t	*lru_prev, *lru_next;
-	uint64_t	offset, length;
-	unsigned	valid:1;
-	int		idx;
-	uint8_t		data[JOURNAL_BUF_SIZE];
+	journal_buf_t		*hash_next;
+	_journal_t		*journal;	/* owner of block, NULL when unused */
+	uint64_t		block, length;
+	unsigned		valid:1, pending:1, referenced:1;
+	unsigned		n_pins;		/* borrowed views, a pinned buf is never reused */
+	journal_waiter_t	*waiters;
+	uint8_t			*data;
+};
+
+/* a buffer for reads too large for the buffer cache */
+struct journal_large_t {
+	journal_large_t		*next_free;
+	journal_large_class_t	*class;
+	uint8_t			*data;
+};
+
+/* Large buffers come in power of two size classes, each class being a
+ * single JOURNAL_LARGE_CLASS_MEM allocation registered alongside the buffer
+ * cache as its own fixed buffer.
+ */
+struct journal_large_class_t {
+	uint64_t		size;
+	unsigned		buf_index;	/* fixed buffer index when registered */
+	journal_large_t		*free;
+	journal_large_t		*larges;
+	uint8_t			*mem;
+};
+
+/* The buffer cache is shared by all journals, it's one big allocation
+ * registered with io_uring as a single fixed buffer, indexed by
+ * (journal, block) and reclaimed via CLOCK.  Blocks are block_size aligned
+ * ranges of the journal files, block_size matching the page or filesystem
+ * block size whichever is larger.
+ */
+typedef struct journal_cache_t {
+	uint64_t		block_size;
+	unsigned		n_bufs, n_buckets, hand;
+	unsigned		registered:1;
+	journal_buf_t		*bufs;
+	journal_buf_t		**buckets;
+	uint8_t			*mem;
+	journal_large_class_t	large[JOURNAL_LARGE_N_CLASSES];
+} journal_cache_t;
+
+typedef struct journal_ra_chunk_t {
+	journal_ra_t		*ra;
+	uint64_t		offset, length;
+	unsigned		valid:1, pending:1;
+	unsigned		n_pins;
+	journal_waiter_t	*waiters;
+	uint8_t			*data;
+} journal_ra_chunk_t;
+
+/* sequential readahead window maintained ahead of journal_iter_next_object() */
+struct journal_ra_t {
+	uint64_t		next;		/* offset where the next chunk read will start */
+	unsigned		n_chunks, n_pending, n_pins;
+	unsigned		released:1;
+	journal_ra_chunk_t	chunks[];
 };
 
-typedef struct _journal_t {
+struct _journal_t {
 	journal_t	public;
-	journal_buf_t	*lru_head, *lru_tail;
-	journal_buf_t	bufs[JOURNAL_BUF_CNT];
-} _journal_t;
+	uint8_t		*map;		/* JOURNAL_BACKEND_MMAP read-only mapping */
+	uint64_t	map_size, map_willneed;
+	journal_ra_t	*ra;
+	uint64_t	blksize;	/* preferred I/O size of the journal's filesystem */
+	uint64_t	bound;		/* extent objects are checked against, see journal_bound() */
+	journal_dev_t	*dev;
+	struct fiemap	*extents;	/* for the elevator on rotational devices */
+	journals_t	*journals;
+	size_t		n;		/* index among the journals found, orders ios lacking extents */
+	unsigned	n_refs;		/* ops in flight and views borrowed, see journal_unref() */
+	unsigned	idle_queued:1;
+	unsigned	abandoned:1;	/* found invalid, see journal_abandon() */
+	thunk_t		*on_abandon;	/* see journal_on_abandon() */
+	unsigned	direct:1;	/* opened O_DIRECT for journals_config.cache_neutral */
+	uint64_t	dontneed;	/* offset page cache has been dropped from, when not direct */
+	thunk_t		*iter_steps[2];	/* got_iter_object_header() closures reused per object, see journal_iter_next_object() */
+	unsigned	iter_steps_busy;	/* bit per iter_steps[] awaiting its read or being dispatched */
+};
 
+/* A device the journals found reside on, with the indices of their names
+ * in journals_found_t.names[], see journals_claim().  Devices with
+ * per-device limits are exclusive, scanned entirely by the one job which
+ * claims the device, so its streams, queue depth and elevator order hold
+ * process-wide, the rest are shared by all the jobs.
+ */
+typedef struct journals_found_dev_t {
+	dev_t		dev;
+	unsigned	rotational:1;
+	unsigned	exclusive:1;
+	journals_t	*owner;		/* job which claimed an exclusive device, atomically */
+	size_t		n_journals;
+	size_t		n_next;		/* next of journals[] to claim, atomically */
+	size_t		*journals;
+} journals_found_dev_t;
+
+/* The names of the journals discovered by journals_open(), shared by the
+ * journals_t of every job, grouped by the devices they're on.  Each journal
+ * is claimed by exactly one job, whichever takes it from its device's
+ * n_next first, which only then allocates its _journal_t, on its own
+ * thread, freeing it once closed.
+ */
+typedef struct journals_found_t {
+	size_t			n_journals, n_allocated;
+	size_t			n_devs, n_exclusive;
+	journals_found_dev_t	*devs;
+	size_t			*dev_journals;	/* backing the devs' journals[] */
+	char			*names[];
+} journals_found_t;
+
+/* A job's journals are opened through a window of at most window open at
+ * once, each occupying a slot of its ring's sparse registered file table
+ * until its scan is finished, at which point it's closed and the next one
+ * claimed and opened in its place.
+ */
 struct journals_t {
-	int		dirfd;
-	size_t		n_journals, n_allocated, n_opened;
-	_journal_t	journals[];
+	iou_t			*iou;
+	journals_found_t	*found;
+	int			flags;		/* open() flags for the journals */
+	unsigned		window, n_free_slots;
+	unsigned		*free_slots;
+	size_t			n_open;		/* claimed and not yet finished */
+	journal_t		**journal_iter;	/* journals_for_each() iterator and closure */
+	thunk_t			*closure;
+};
+
+
+journals_config_t	journals_config = {
+	.cache_size = JOURNAL_CACHE_DEFAULT,
+	.queue_depth = JOURNAL_QUEUE_DEPTH_DEFAULT,
+	.jobs = 1,
+	.splits = 1,
 };
 
+/* discovery is shared by all jobs, done by whichever gets to journals_open() first */
+static pthread_mutex_t		journals_found_lock = PTHREAD_MUTEX_INITIALIZER;
+static journals_found_t		*journals_found;
+static int			journals_discovered;
+
+/* everything else is per job, each with its own ring on its own thread */
+static __thread journal_cache_t	journal_cache;
+
+static __thread struct {
+	unsigned	n_inflight;
+	journal_dev_t	*devs;
+	journal_dev_t	*hand;		/* device to admit from next */
+} journal_ios;
+
+/* ios and waiters come and go with every read missing the cache, so
+ * they're recycled here instead of going back to the heap.
+ */
+static __thread struct {
+	journal_io_t		*ios;
+	journal_waiter_t	*waiters;
+} journal_pool;
+
 
-/* helper for bumping buf down to the bottom of journal->lru_{head,tail},
- * this should probably just pull in some linked list header like the kernel's
- * list.h, open coded slop for now
+/* Free the calling thread's pooled ios and waiters, which would otherwise
+ * be leaked by a job's thread exiting, see jobs_run().
  */
-static void buf_used(_journal_t *journal, journal_buf_t *buf)
+void journals_pool_free(void)
 {
-	assert(journal);
-	assert(buf);
+	while (journal_pool.ios) {
+		journal_io_t	*io = journal_pool.ios;
 
-	if (journal->lru_tail == buf)
-		return;
+		journal_pool.ios = io->next;
+		free(io);
+	}
 
-	if (buf->lru_prev)
-		buf->lru_prev->lru_next = buf->lru_next;
-	else
-		journal->lru_head = buf->lru_next;
+	while (journal_pool.waiters) {
+		journal_waiter_t	*w = journal_pool.waiters;
+
+		journal_pool.waiters = w->next;
+		free(w);
+	}
+}
+
+
+/* iou_op_new() comes up empty when the submission queue is full, flushing
+ * what's queued so far makes room.
+ */
+static iou_op_t * journal_op_new(iou_t *iou)
+{
+	iou_op_t	*op;
 
-	buf->lru_next->lru_prev = buf->lru_prev;
-	buf->lru_next = NULL;
+	op = iou_op_new(iou);
+	if (!op && iou_flush(iou) >= 0)
+		op = iou_op_new(iou);
 
-	journal->lru_tail->lru_next = buf;
-	buf->lru_prev = journal->lru_tail;
-	journal->lru_tail = buf;
+	return op;
 }
 
 
-THUNK_DEFINE_STATIC(buf_got_read, iou_t *, iou, iou_op_t *, op, void *, dest, uint64_t, offset, uint64_t, length, journal_buf_t *, buf, thunk_t *, closure)
+static int journal_close(_journal_t *_journal);
+
+
+/* A journal's scan may have finished once nothing references it anymore, but
+ * dropping the last reference is often immediately followed by the
+ * continuation taking a new one, like when a view is released before moving
+ * on to the next object.  So the journal only gets closed if it's still
+ * unreferenced once a nop queued here completes.
+ */
+THUNK_DEFINE_STATIC(journal_idle, _journal_t *, _journal)
 {
-	assert(iou);
-	assert(op);
-	assert(closure);
-	assert(dest || !buf);
+	assert(_journal);
 
-	if (op->result < 0)
-		return op->result;
+	_journal->idle_queued = 0;
+	if (_journal->n_refs)
+		return 0;
 
-	if (op->result < length)
-		return -EINVAL;
+	return journal_close(_journal);
+}
 
-	if (buf) {
-		memcpy(dest, buf->data, length);
-		buf->length = op->result;
-		buf->offset = offset;
-		buf->valid = 1;
-	}
 
-	return thunk_end(thunk_dispatch(closure));
+static int journal_unref(_journal_t *_journal)
+{
+	iou_t		*iou = _journal->journals->iou;
+	iou_op_t	*op;
+
+	assert(_journal->n_refs);
+
+	_journal->n_refs--;
+	if (_journal->n_refs || _journal->idle_queued)
+		return 0;
+
+	op = journal_op_new(iou);
+	if (!op)
+		return -ENOMEM;
+
+	io_uring_prep_nop(op->sqe);
+	op_queue(iou, op, THUNK(journal_idle(_journal)));
+	_journal->idle_queued = 1;
+
+	return 0;
 }
 
 
-/* read size bytes from offset offset in journal to dest, dispatch closure when done.
- * for reads <= JOURNAL_BUF_SIZE in size, a per-journal cache of
- * JOURNAL_BUF_CNT*JOURNAL_BUF_SIZE buffers is maintained and if the data is
- * present it's simply copied from there before dispatching closure.
+/* Journals found invalid are abandoned by their loaders returning
+ * -EUCLEAN, which ends the journal's chain of closures.  That's not an
+ * error for the run, so where journal work gets dispatched it's swallowed
+ * here, everything in flight for the journal dropping its references as
+ * usual until it's closed, when its journal_on_abandon() closure is run.
  */
-int journal_read(iou_t *iou, journal_t *journal, uint64_t offset, uint64_t length, void *dest, thunk_t *closure)
+static inline int journal_abandon(_journal_t *_journal, int r)
 {
-	_journal_t	*_journal = container_of(journal, _journal_t, public);
-	journal_buf_t	*buf;
-	iou_op_t	*op;
+	if (r != -EUCLEAN)
+		return r;
 
-	assert(iou);
-	assert(journal);
-	assert(length);
-	assert(dest);
-	assert(closure);
+	_journal->abandoned = 1;
+
+	return 0;
+}
 
-	if (length <= JOURNAL_BUF_SIZE) {
-		/* small enough to fit, look in the buffers */
 
-		for (int i = 0; i < JOURNAL_BUF_CNT; i++) {
-			journal_buf_t	*buf = &_journal->bufs[i];
+/* completion of an op queued by journal_op_queue(), drop its reference after dispatching closure */
+THUNK_DEFINE_STATIC(journal_op_done, _journal_t *, _journal, thunk_t *, closure)
+{
+	int	r;
 
-			if (!buf->valid)
-				continue;
+	assert(_journal);
+	assert(closure);
 
-			if (offset >= buf->offset && offset + length <= buf->offset + buf->length) {
-				buf_used(_journal, buf);
-				memcpy(dest, &buf->data[offset - buf->offset], length);
+	r = journal_abandon(_journal, thunk_dispatch(closure));
+	if (r < 0)
+		return r;
 
-				return thunk_end(thunk_dispatch(closure));
-			}
-		}
+	return journal_unref(_journal);
+}
 
-		/* buffer fits, but wasn't found, read it into the "fixed" lru buf,
-		 * buf_got_read() will then copy out of the buf into dest when loaded.
-		 */
-		buf = _journal->lru_head;
-		buf_used(_journal, buf);
-		buf->valid = 0;
 
-		op = iou_op_new(iou);
-		if (!op)
-			return -ENOMEM;
+/* op_queue() an op on behalf of _journal, which is held open until it completes */
+static void journal_op_queue(iou_t *iou, _journal_t *_journal, iou_op_t *op, thunk_t *closure)
+{
+	_journal->n_refs++;
+	op_queue(iou, op, THUNK(journal_op_done(_journal, closure)));
+}
 
-		io_uring_prep_read_fixed(op->sqe, journal->idx, buf->data, JOURNAL_BUF_SIZE, offset, buf->idx);
-		op->sqe->flags = IOSQE_FIXED_FILE;
-		op_queue(iou, op, THUNK(buf_got_read(iou, op, dest, offset, length, buf, closure)));
-	} else {
-		/* buffer doesn't fit, plain unbuffered read it into provided dest (assumed to be non-fixed)  */
 
-		op = iou_op_new(iou);
-		if (!op)
-			return -ENOMEM;
+/* Dispatch closure for a read satisfied synchronously from memory.
+ *
+ * Cached reads never touch the ring, so a long run of them turns into ever
+ * deeper recursion through the continuations of an iteration.  Once nested
+ * JOURNAL_DISPATCH_DEPTH deep, bounce the dispatch off a nop op to unwind the
+ * stack.
+ */
+static int journal_dispatch(iou_t *iou, _journal_t *_journal, thunk_t *closure)
+{
+	static __thread unsigned	depth;
+	iou_op_t			*op;
+	int		r;
+
+	if (depth < JOURNAL_DISPATCH_DEPTH) {
+		depth++;
+		r = thunk_dispatch(closure);
+		depth--;
 
-		io_uring_prep_read(op->sqe, journal->idx, dest, length, offset);
-		op->sqe->flags = IOSQE_FIXED_FILE;
-		op_queue(iou, op, THUNK(buf_got_read(iou, op, NULL, offset, length, NULL, closure)));
+		return thunk_end(r);
 	}
 
+	op = journal_op_new(iou);
+	if (!op)
+		return -ENOMEM;
+
+	io_uring_prep_nop(op->sqe);
+	journal_op_queue(iou, _journal, op, closure);
+
 	return 0;
 }
 
 
-/* an open on journal->name was attempted, result in op->result.
- * bump *journals->n_opened, when it matches *journals->n_journals, dispatch closure
+/* Is dev backed by a rotational disk?  Partitions don't have their own
+ * queue in sysfs, it's their parent's.  When in doubt, it's not.
  */
-THUNK_DEFINE_STATIC(opened_journal, iou_t *, iou, iou_op_t *, op, journals_t *, journals, _journal_t *, _journal, thunk_t *, closure)
+static int journal_dev_rotational(dev_t dev)
 {
-	journal_t	*journal = &_journal->public;
+	static const char	*fmts[] = {
+		"/sys/dev/block/%u:%u/queue/rotational",
+		"/sys/dev/block/%u:%u/../queue/rotational",
+	};
 
-	assert(iou);
-	assert(op);
-	assert(journals);
-	assert(_journal);
-	assert(closure);
+	for (int i = 0; i < sizeof(fmts) / sizeof(*fmts); i++) {
+		char	path[64];
+		FILE	*f;
+		int	c;
 
-	/* note n_opened is a count of open calls, not successes, the closure only gets called
-	 * when all the opens have been performed hence the need to count them.
-	 */
-	journals->n_opened++;
+		snprintf(path, sizeof(path), fmts[i], major(dev), minor(dev));
+		f = fopen(path, "r");
+		if (!f)
+			continue;
 
-	if (op->result < 0 ) {
-		if (op->result != -EPERM && op->result != -EACCES)
-			return op->result;
+		c = fgetc(f);
+		fclose(f);
 
-		fprintf(stderr, "Permission denied opening \"%s\", ignoring\n", journal->name);
-		journal->fd = -1;
-	} else {
+		return c == '1';
+	}
 
-		/* setup journal->lru_{head,tail} bufs list */
-		_journal->lru_head = _journal->lru_tail = &_journal->bufs[0];
-		for (int i = 1; i < JOURNAL_BUF_CNT; i++) {
-			journal_buf_t	*buf = &_journal->bufs[i];
+	return 0;
+}
 
-			_journal->lru_tail->lru_next = buf;
-			buf->lru_prev = _journal->lru_tail;
-			_journal->lru_tail = buf;
-		}
 
-		journal->fd = op->result;
+/* find or add the device dev, rotational as found by journals_index() */
+static journal_dev_t * journal_dev_get(dev_t dev, int rotational)
+{
+	journal_dev_t	*d;
+
+	for (d = journal_ios.devs; d; d = d->next) {
+		if (d->dev == dev)
+			return d;
 	}
 
-	if (journals->n_opened == journals->n_journals) {
-		int	*fds, r;
+	d = calloc(1, sizeof(*d));
+	if (!d)
+		return NULL;
 
-		/* "register" all the opened journals, storing their respective
-		 * index in journal->idx for convenience.
-		 */
-		fds = malloc(sizeof(*fds) * journals->n_journals);
-		if (!fds)
-			return -ENOMEM;
+	d->dev = dev;
+	d->rotational = rotational;
 
-		for (int i = 0; i < journals->n_journals; i++) {
-			fds[i] = journals->journals[i].public.fd;
-			journals->journals[i].public.idx = i;
-		}
+	d->max_streams = journals_config.device_streams;
+	if (!d->max_streams && d->rotational)
+		d->max_streams = JOURNAL_ROTATIONAL_STREAMS;
 
-		r = io_uring_register_files(iou_ring(iou), fds, journals->n_journals);
-		if (r < 0)
-			return r;
+	d->next = journal_ios.devs;
+	journal_ios.devs = d;
 
-		{
-			struct iovec	*bufs;
-			int		n_bufs = 0;
+	return d;
+}
 
-			bufs = malloc(sizeof(*bufs) * JOURNAL_BUF_CNT * journals->n_journals);
-			if (!bufs)
-				return -ENOMEM;
 
-			for (int i = 0; i < journals->n_journals; i++) {
-				/* "register" buffers with io_uring for a perf boost */
+static journal_io_t * journal_io_new(_journal_t *_journal, uint8_t opcode, void *buf, uint64_t length, uint64_t offset)
+{
+	journal_io_t	*io;
 
+	io = journal_pool.ios;
+	if (io) {
+		journal_pool.ios = io->next;
+		memset(io, 0, sizeof(*io));
+	} else {
+		io = calloc(1, sizeof(*io));
+		if (!io)
+			return NULL;
+	}
 
-				for (int j = 0; j < JOURNAL_BUF_CNT; j++) {
-					journal_buf_t	*buf = &journals->journals[i].bufs[j];
+	io->journal = _journal;
+	io->opcode = opcode;
+	io->buf = buf;
+	io->length = length;
+	io->offset = offset;
 
-					bufs[n_bufs].iov_base = buf->data;
-					bufs[n_bufs].iov_len = JOURNAL_BUF_SIZE;
-					buf->idx = n_bufs++;
-				}
-			}
+	return io;
+}
 
-			r = io_uring_register_buffers(iou_ring(iou), bufs, n_bufs);
-			if (r < 0) {
-				free(bufs);
-				return r;
-			}
 
-			free(bufs);
-		}
+static int journal_io_admit(iou_t *iou);
 
-		free(fds);
 
-		return thunk_end(thunk_dispatch(closure));
+/* Where io falls in its device's elevator order.  With an extent map that's
+ * the physical offset, otherwise each journal's ios are simply kept together
+ * in file order.
+ */
+static uint64_t journal_io_key(journal_io_t *io)
+{
+	_journal_t	*_journal = io->journal;
+	struct fiemap	*fm = _journal->extents;
+
+	if (fm) {
+		unsigned	lo = 0, hi = fm->fm_mapped_extents;
+
+		while (lo < hi) {
+			unsigned		mid = (lo + hi) / 2;
+			struct fiemap_extent	*fe = &fm->fm_extents[mid];
+
+			if (io->offset < fe->fe_logical)
+				hi = mid;
+			else if (io->offset >= fe->fe_logical + fe->fe_length)
+				lo = mid + 1;
+			else if (!(fe->fe_flags & FIEMAP_EXTENT_UNKNOWN))
+				return fe->fe_physical + io->offset - fe->fe_logical;
+			else
+				break;
+		}
 	}
 
-	return 0;
+	return ((uint64_t)_journal->n << 40) + io->offset;
 }
 
 
-THUNK_DEFINE_STATIC(get_journals, iou_t *, iou, iou_op_t *, op, journals_t **, journals, int, flags, thunk_t *, closure)
+/* reads go into io->buf whether registered or not, so can share a readv */
+static int journal_io_is_read(const journal_io_t *io)
 {
-	struct dirent	*dent;
-	DIR		*jdir;
-	size_t		n = 0;
-	journals_t	*j;
+	return io->opcode == IORING_OP_READ || io->opcode == IORING_OP_READ_FIXED;
+}
+
+
+/* unlink and return the io @ *p from dev's queue, advancing the elevator to it */
+static journal_io_t * journal_io_unlink(journal_dev_t *dev, journal_io_t **p)
+{
+	journal_io_t	*io = *p;
+
+	*p = io->next;
+	dev->head = io->key + io->length;
+
+	return io;
+}
+
+
+/* an admitted io completed, dispatch its closure and admit more in its place */
+THUNK_DEFINE_STATIC(journal_io_done, iou_t *, iou, iou_op_t *, op, journal_io_t *, io)
+{
+	_journal_t	*_journal = io->journal;
+	int		remaining = op->result;
+	unsigned	n_ios = 0;
 	int		r;
 
 	assert(iou);
 	assert(op);
-	assert(journals);
-	assert(closure);
+	assert(io);
 
-	if (op->result < 0)
-		return op->result;
+	journal_ios.n_inflight--;
+	_journal->dev->n_inflight--;
 
-	/* I don't see any readdir/getdents ops for io_uring, so just do the opendir/readdir
-	 * synchronously here before queueing the opening of all those paths.
+	/* a merged readv's result is spread across its reads in order, short
+	 * reads leave the trailing ones short too, as they would've been alone.
 	 */
-	jdir = fdopendir(op->result);
-	if (jdir == NULL) {
-		int	r = errno;
+	for (journal_io_t *next; io; io = next) {
+		next = io->merged;
+
+		if (op->result < 0) {
+			io->result = op->result;
+		} else {
+			io->result = remaining < io->length ? remaining : io->length;
+			remaining -= io->result;
+		}
 
-		close(op->result); /* only on successful fdopendir is the fd owned and closed by jdir */
+		r = journal_abandon(io->journal, thunk_dispatch(io->closure));
+		io->next = journal_pool.ios;
+		journal_pool.ios = io;
+		if (r < 0)
+			return r;
 
-		return r;
+		n_ios++;
 	}
 
-	while ((dent = readdir(jdir))) {
-		if (dent->d_name[0] == '.')	/* just skip dot files and "." ".." */
-			continue;
+	r = journal_io_admit(iou);
+	if (r < 0)
+		return r;
 
-		n++;
+	while (n_ios--) {
+		r = journal_unref(_journal);
+		if (r < 0)
+			return r;
 	}
-	rewinddir(jdir);
 
-	if (!n)	/* no journals! */
-		return 0;
+	return 0;
+}
 
-	j = calloc(1, sizeof(journals_t) + sizeof(j->journals[0]) * n);
-	if (!j) {
-		closedir(jdir);
-		return -ENOMEM;
-	}
 
-	j->n_allocated = n;
+/* submit an admitted io to the ring */
+static int journal_io_issue(iou_t *iou, journal_io_t *io)
+{
+	int		idx = io->journal->public.idx;
+	iou_op_t	*op;
 
-	while ((dent = readdir(jdir))) {
-		if (dent->d_name[0] == '.')	/* just skip dot files and "." ".." */
-			continue;
+	op = journal_op_new(iou);
+	if (!op)
+		return -ENOMEM;
 
-		j->journals[j->n_journals++].public.name = strdup(dent->d_name);
+	switch (io->merged ? IORING_OP_READV : io->opcode) {
+	case IORING_OP_READV: {
+		unsigned	n = 0;
 
-		assert(j->n_journals <= j->n_allocated);// FIXME this defends against the race, but the race
-							// is a normal thing and should be handled gracefully,
-							// or just stop doing this two pass dance.
-	}
+		for (journal_io_t *m = io; m; m = m->merged) {
+			assert(n < JOURNAL_IO_MERGE_MAX);
+			io->iovecs[n].iov_base = m->buf;
+			io->iovecs[n].iov_len = m->length;
+			n++;
+		}
 
-	/* duplicate the dirfd for openat use later on, since closedir() will close op->result */
-	j->dirfd = dup(op->result);
-	closedir(jdir);
+		io_uring_prep_readv(op->sqe, idx, io->iovecs, n, io->offset);
+		break;
+	}
 
-	/* to keep things relatively simple, let's ensure there's enough queue space for at least one
-	 * operation per journal.
-	 */
-	r = iou_resize(iou, j->n_journals);
-	if (r < 0)
-		return r;	/* TODO: cleanup j */
+	case IORING_OP_READ:
+		io_uring_prep_read(op->sqe, idx, io->buf, io->length, io->offset);
+		break;
 
-	/* we have a list of journal names, now queue requests to open them all */
-	for (size_t i = 0; i < j->n_journals; i++) {
-		iou_op_t	*oop;
+	case IORING_OP_READ_FIXED:
+		io_uring_prep_read_fixed(op->sqe, idx, io->buf, io->length, io->offset, io->buf_index);
+		break;
 
-		oop = iou_op_new(iou);
-		if (!oop)
-			return -ENOMEM;	// FIXME: cleanup
+	case IORING_OP_FADVISE:
+		io_uring_prep_fadvise(op->sqe, idx, io->offset, io->length, io->advice);
+		break;
 
-		io_uring_prep_openat(oop->sqe, j->dirfd, j->journals[i].public.name, flags, 0);
-		op_queue(iou, oop, THUNK(opened_journal(iou, oop, j, &j->journals[i], closure)));
+	default:
+		assert(0);
 	}
+	op->sqe->flags = IOSQE_FIXED_FILE;
+	op_queue(iou, op, THUNK(journal_io_done(iou, op, io)));
 
-	iou_flush(iou);
-
-	/* stow the journals where they can be found, but note they aren't opened yet. */
-	*journals = j;
+	journal_ios.n_inflight++;
+	io->journal->dev->n_inflight++;
 
 	return 0;
 }
 
 
-THUNK_DEFINE_STATIC(var_opened, iou_t *, iou, iou_op_t *, op, char **, machid, journals_t **, journals, int, flags, thunk_t *, closure)
+/* Take the next io from dev's queue in C-SCAN order; the first at or beyond
+ * the last admitted position, wrapping around to the lowest once there's
+ * nothing beyond it.
+ */
+static journal_io_t * journal_dev_next_io(journal_dev_t *dev)
 {
-	iou_op_t	*mop;
+	journal_io_t	**p, *io, *last;
+	uint64_t	length;
+	unsigned	n = 1;
 
-	if (op->result < 0)
-		return op->result;
+	for (p = &dev->queue; *p && (*p)->key < dev->head; p = &(*p)->next);
+	if (!*p)
+		p = &dev->queue;
 
-	/* PERSISTENT_PATH is opened, req open ./$machid */
-	mop = iou_op_new(iou);
-	if (!mop)
-		return -ENOMEM;
+	io = last = journal_io_unlink(dev, p);
+	if (!journal_io_is_read(io))
+		return io;
 
-	/* req iou to open dir, passing the req to read and open its contents */
-	io_uring_prep_openat(mop->sqe, op->result, *machid, O_DIRECTORY|O_RDONLY, 0);
-	op_queue(iou, mop, THUNK(get_journals(iou, mop, journals, flags, closure)));
+	/* whatever's queued next in elevator order continuing where io leaves
+	 * off in the same journal gets read along with it.
+	 */
+	for (length = io->length;
+	     *p && n < JOURNAL_IO_MERGE_MAX &&
+	     (*p)->journal == io->journal &&
+	     journal_io_is_read(*p) &&
+	     (*p)->offset == last->offset + last->length &&
+	     length + (*p)->length <= JOURNAL_IO_MERGE_SIZE;
+	     n++) {
+		length += (*p)->length;
+		last = last->merged = journal_io_unlink(dev, p);
+	}
 
-	return 0;
+	return io;
 }
 
 
-/* requesting opening the journals via iou, allocating the resulting journals_t @ *journals */
-/* returns < 0 on error, 0 on successful queueing of operation */
-THUNK_DEFINE(journals_open, iou_t *, iou, char **, machid, int, flags, journals_t **, journals, thunk_t *, closure)
+/* Issue queued ios while there's room under journals_config.queue_depth,
+ * taking turns between devices with queued ios and room under
+ * journals_config.device_queue_depth.
+ */
+static int journal_io_admit(iou_t *iou)
 {
-	iou_op_t	*op;
+	unsigned	depth = journals_config.queue_depth;
+	unsigned	device_depth = journals_config.device_queue_depth;
 
-	assert(iou);
-	assert(machid);
-	assert(journals);
-	assert(closure);
+	while (!depth || journal_ios.n_inflight < depth) {
+		journal_dev_t	*start, *d;
+		journal_io_t	*io;
+		int		r;
 
-	op = iou_op_new(iou);
-	if (!op)
-		return -ENOMEM;
+		start = d = journal_ios.hand ? journal_ios.hand : journal_ios.devs;
+		if (!d)
+			break;
+
+		while (!d->queue || (device_depth && d->n_inflight >= device_depth)) {
+			d = d->next ? d->next : journal_ios.devs;
+			if (d == start) {
+				d = NULL;
+				break;
+			}
+		}
+
+		if (!d)
+			break;
+
+		io = journal_dev_next_io(d);
+		journal_ios.hand = d->next;
 
-	/* req iou to open PERSISTENT_PATH, passing on to var_opened */
-	io_uring_prep_openat(op->sqe, 0, PERSISTENT_PATH, O_DIRECTORY|O_RDONLY, 0);
-	op_queue(iou, op, THUNK(var_opened(iou, op, machid, journals, flags, closure)));
+		r = journal_io_issue(iou, io);
+		if (r < 0)
+			return r;
+	}
 
 	return 0;
 }
 
 
-
-THUNK_DEFINE_STATIC(got_iter_object_header, iou_t *, iou, journal_t *, journal, uint64_t *, iter_offset, ObjectHeader *, iter_object_header, thunk_t *, closure)
+/* Queue io for admission, holding its journal open until it completes.
+ * io->closure must already be set.
+ */
+static int journal_io_submit(iou_t *iou, journal_io_t *io)
 {
-	assert(iou);
-	assert(journal);
-	assert(iter_offset);
-	assert(iter_object_header);
-	assert(closure);
+	journal_dev_t	*dev = io->journal->dev;
+	journal_io_t	**p;
 
-	iter_object_header->size = le64toh(iter_object_header->size);
+	assert(io->closure);
 
-	return thunk_end(thunk_dispatch(closure));
+	io->journal->n_refs++;
+	io->key = journal_io_key(io);
+
+	for (p = &dev->queue; *p && (*p)->key <= io->key; p = &(*p)->next);
+	io->next = *p;
+	*p = io;
+
+	return journal_io_admit(iou);
 }
 
 
-/* Queues IO on iou for getting the next object from (*journal)->fd
- * addressed by state in {iter_offset,iter_object_header} storing it @
+/* queue a read or borrow (dest or view) on a pending fill for replay when it lands */
+static int waiter_add(journal_waiter_t **waiters, uint64_t offset, uint64_t length, void *dest, journal_view_t *view, thunk_t *closure)
+{
+	journal_waiter_t	*w, **tail;
+
+	w = journal_pool.waiters;
+	if (w)
+		journal_pool.waiters = w->next;
+	else if (!(w = malloc(sizeof(*w))))
+		return -ENOMEM;
+
+	w->next = NULL;
+	w->offset = offset;
+	w->length = length;
+	w->dest = dest;
+	w->view = view;
+	w->closure = closure;
+
+	for (tail = waiters; *tail; tail = &(*tail)->next);
+	*tail = w;
+
+	return 0;
+}
+
+
+/* replay and free the waiters list, which must already be detached from where it waited */
+static int waiters_replay(iou_t *iou, journal_t *journal, journal_waiter_t *waiters)
+{
+	journal_waiter_t	*next;
+
+	for (journal_waiter_t *w = waiters; w; w = next) {
+		int	r;
+
+		next = w->next;
+		if (w->view)
+			r = journal_borrow(iou, journal, w->offset, w->length, w->view, w->closure);
+		else
+			r = journal_read(iou, journal, w->offset, w->length, w->dest, w->closure);
+		w->next = journal_pool.waiters;
+		journal_pool.waiters = w;
+		if (r < 0)
+			return r;
+	}
+
+	return 0;
+}
+
+
+static void ra_free(journal_ra_t *ra)
+{
+	for (unsigned i = 0; i < ra->n_chunks; i++)
+		free(ra->chunks[i].data);
+
+	free(ra);
+}
+
+
+/* readahead chunk read completed, replay any reads which were waiting on it */
+THUNK_DEFINE_STATIC(ra_chunk_got_read, iou_t *, iou, journal_io_t *, io, journal_t *, journal, journal_ra_t *, ra, journal_ra_chunk_t *, chunk)
+{
+	journal_waiter_t	*waiters;
+	int			r;
+
+	assert(iou);
+	assert(io);
+	assert(ra);
+	assert(chunk);
+
+	ra->n_pending--;
+	chunk->pending = 0;
+
+	/* a short read past EOF just leaves a shorter chunk, waiters no longer
+	 * covered by it fall through to the regular journal_read() path, as do
+	 * all of them if the window has been released in the meantime, or the
+	 * chunk failed to be read.
+	 */
+	if (io->result >= 0) {
+		chunk->length = io->result;
+		chunk->valid = 1;
+	}
+
+	waiters = chunk->waiters;
+	chunk->waiters = NULL;
+
+	r = waiters_replay(iou, journal, waiters);
+	if (r < 0)
+		return r;
+
+	if (ra->released && !ra->n_pending && !ra->n_pins)
+		ra_free(ra);
+
+	if (io->result < 0)
+		return io->result;
+
+	return 0;
+}
+
+
+/* find the readahead chunk covering offset+length, if any */
+static journal_ra_chunk_t * ra_find(_journal_t *_journal, uint64_t offset, uint64_t length)
+{
+	journal_ra_t	*ra = _journal->ra;
+
+	if (!ra)
+		return NULL;
+
+	for (unsigned i = 0; i < ra->n_chunks; i++) {
+		journal_ra_chunk_t	*chunk = &ra->chunks[i];
+
+		if (!chunk->valid && !chunk->pending)
+			continue;
+
+		if (offset < chunk->offset || offset + length > chunk->offset + chunk->length)
+			continue;
+
+		return chunk;
+	}
+
+	return NULL;
+}
+
+
+static void ra_chunk_unpin(void *pin)
+{
+	journal_ra_chunk_t	*chunk = pin;
+	journal_ra_t		*ra = chunk->ra;
+
+	assert(chunk->n_pins);
+
+	chunk->n_pins--;
+	ra->n_pins--;
+
+	if (ra->released && !ra->n_pending && !ra->n_pins)
+		ra_free(ra);
+}
+
+
+/* Keep up to journals_config.readahead bytes of reads in flight ahead of offset
+ * and below limit, recycling chunks the cursor has moved past.  A cursor which
+ * isn't covered by the current window, like when an iteration restarts, simply
+ * restarts the window at the cursor.
+ */
+static int journal_readahead(iou_t *iou, _journal_t *_journal, uint64_t offset, uint64_t limit)
+{
+	journal_ra_t	*ra = _journal->ra;
+	int		covered = 0;
+
+	if (!journals_config.readahead)
+		return 0;
+
+	/* mapped journals leave the reading to the kernel, just tell it what's coming */
+	if (_journal->map) {
+		if (limit > _journal->map_size)
+			limit = _journal->map_size;
+
+		if (offset + journals_config.readahead / 2 >= _journal->map_willneed && _journal->map_willneed < limit) {
+			uint64_t	start, end;
+
+			start = offset & ~(uint64_t)(JOURNAL_RA_ALIGN - 1);
+			if (start < _journal->map_willneed)
+				start = _journal->map_willneed;
+
+			end = offset + journals_config.readahead;
+			if (end > limit)
+				end = limit;
+
+			(void) madvise(_journal->map + start, end - start, MADV_WILLNEED);
+			_journal->map_willneed = end;
+		}
+
+		return 0;
+	}
+
+	if (!ra) {
+		unsigned	n_chunks;
+
+		n_chunks = (journals_config.readahead + JOURNAL_RA_CHUNK_SIZE - 1) / JOURNAL_RA_CHUNK_SIZE;
+		if (n_chunks < JOURNAL_RA_MIN_CHUNKS)
+			n_chunks = JOURNAL_RA_MIN_CHUNKS;
+
+		ra = calloc(1, sizeof(journal_ra_t) + sizeof(journal_ra_chunk_t) * n_chunks);
+		if (!ra)
+			return -ENOMEM;
+
+		ra->n_chunks = n_chunks;
+		for (unsigned i = 0; i < n_chunks; i++)
+			ra->chunks[i].ra = ra;
+
+		_journal->ra = ra;
+	}
+
+	for (unsigned i = 0; i < ra->n_chunks; i++) {
+		journal_ra_chunk_t	*chunk = &ra->chunks[i];
+
+		if ((chunk->valid || chunk->pending) && offset >= chunk->offset && offset < chunk->offset + chunk->length) {
+			covered = 1;
+			break;
+		}
+	}
+
+	if (!covered)
+		ra->next = offset & ~(uint64_t)(JOURNAL_RA_ALIGN - 1);
+
+	for (unsigned i = 0; i < ra->n_chunks && ra->next < limit; i++) {
+		journal_ra_chunk_t	*chunk = &ra->chunks[i];
+		journal_io_t		*io;
+		int			r;
+
+		if (chunk->pending || chunk->n_pins)
+			continue;
+
+		/* leave chunks still ahead of or under the cursor alone */
+		if (chunk->valid && chunk->offset + chunk->length > offset && chunk->offset < ra->next)
+			continue;
+
+		if (!chunk->data) {
+			if (posix_memalign((void **)&chunk->data, JOURNAL_RA_ALIGN, JOURNAL_RA_CHUNK_SIZE))
+				return -ENOMEM;
+		}
+
+		chunk->offset = ra->next;
+		chunk->length = limit - ra->next;
+		if (chunk->length > JOURNAL_RA_CHUNK_SIZE)
+			chunk->length = JOURNAL_RA_CHUNK_SIZE;
+		if (_journal->direct)	/* O_DIRECT wants whole blocks, the result trims any excess */
+			chunk->length = (chunk->length + JOURNAL_RA_ALIGN - 1) & ~(uint64_t)(JOURNAL_RA_ALIGN - 1);
+
+		io = journal_io_new(_journal, IORING_OP_READ, chunk->data, chunk->length, chunk->offset);
+		if (!io)
+			return -ENOMEM;
+
+		chunk->valid = 0;
+		chunk->pending = 1;
+		ra->next += chunk->length;
+		ra->n_pending++;
+
+		io->closure = THUNK(ra_chunk_got_read(iou, io, &_journal->public, ra, chunk));
+		r = journal_io_submit(iou, io);
+		if (r < 0)
+			return r;
+	}
+
+	return 0;
+}
+
+
+/* An object of size bytes was found @ offset while scanning.  When it's
+ * larger than a readahead chunk its payload can never be served from the
+ * window, whoever wants it borrows or reads it separately, so don't have the
+ * window read it.  The window instead resumes at the next object header,
+ * which along with the header already loaded is all a scan needs of it.
+ */
+static void journal_readahead_skip(_journal_t *_journal, uint64_t offset, uint64_t size)
+{
+	uint64_t	next;
+
+	if (!journals_config.readahead || size <= JOURNAL_RA_CHUNK_SIZE)
+		return;
+
+	next = (offset + ALIGN64(size)) & ~(uint64_t)(JOURNAL_RA_ALIGN - 1);
+
+	if (_journal->map) {
+		if (_journal->map_willneed < next)
+			_journal->map_willneed = next;
+
+		return;
+	}
+
+	if (_journal->ra && _journal->ra->next < next)
+		_journal->ra->next = next;
+}
+
+
+/* Drop the journal's readahead window, chunks still in flight or pinned by
+ * borrowed views keep it allocated until they land or get released.
+ */
+static void journal_readahead_release(_journal_t *_journal)
+{
+	journal_ra_t	*ra = _journal->ra;
+
+	if (!ra)
+		return;
+
+	_journal->ra = NULL;
+
+	if (ra->n_pending || ra->n_pins) {
+		ra->released = 1;
+		return;
+	}
+
+	ra_free(ra);
+}
+
+
+/* Allocate the shared buffer cache and register it with iou's ring.
+ * Failing to register, as happens when exceeding RLIMIT_MEMLOCK, isn't fatal,
+ * the cache then simply gets filled via regular reads.
+ * blksize is the largest block size of the filesystems the journals reside on.
+ */
+/* undo a partially built cache, leaving it to be built from scratch */
+static void journal_cache_unwind(journal_cache_t *cache)
+{
+	for (unsigned i = 0; i < JOURNAL_LARGE_N_CLASSES; i++) {
+		free(cache->large[i].larges);
+		free(cache->large[i].mem);
+	}
+
+	free(cache->bufs);
+	free(cache->buckets);
+	free(cache->mem);
+	memset(cache, 0, sizeof(*cache));
+}
+
+
+static int journal_cache_init(iou_t *iou, uint64_t blksize)
+{
+	journal_cache_t	*cache = &journal_cache;
+	struct iovec	iovs[1 + JOURNAL_LARGE_N_CLASSES];
+	uint64_t	block_size;
+	unsigned	n_bufs;
+
+	if (cache->bufs)
+		return 0;
+
+	block_size = sysconf(_SC_PAGESIZE);
+	if (blksize > block_size && blksize <= JOURNAL_BLOCK_MAX && !(blksize & (blksize - 1)))
+		block_size = blksize;
+
+	cache->block_size = block_size;
+
+	n_bufs = journals_config.cache_size / block_size;
+	if (n_bufs < JOURNAL_CACHE_MIN_BUFS)
+		n_bufs = JOURNAL_CACHE_MIN_BUFS;
+
+	cache->n_buckets = 1;
+	while (cache->n_buckets < n_bufs)
+		cache->n_buckets <<= 1;
+
+	cache->bufs = calloc(n_bufs, sizeof(*cache->bufs));
+	cache->buckets = calloc(cache->n_buckets, sizeof(*cache->buckets));
+	if (!cache->bufs || !cache->buckets ||
+	    posix_memalign((void **)&cache->mem, block_size, (size_t)n_bufs * block_size)) {
+		journal_cache_unwind(cache);
+
+		return -ENOMEM;
+	}
+
+	cache->n_bufs = n_bufs;
+	for (unsigned i = 0; i < n_bufs; i++)
+		cache->bufs[i].data = &cache->mem[(size_t)i * block_size];
+
+	iovs[0].iov_base = cache->mem;
+	iovs[0].iov_len = (size_t)n_bufs * block_size;
+
+	for (unsigned i = 0; i < JOURNAL_LARGE_N_CLASSES; i++) {
+		journal_large_class_t	*class = &cache->large[i];
+		unsigned		n_larges;
+
+		class->size = (uint64_t)JOURNAL_LARGE_MIN_SIZE << i;
+		class->buf_index = 1 + i;
+
+		n_larges = JOURNAL_LARGE_CLASS_MEM / class->size;
+		class->larges = calloc(n_larges, sizeof(*class->larges));
+		if (!class->larges ||
+		    posix_memalign((void **)&class->mem, JOURNAL_DIRECT_ALIGN, JOURNAL_LARGE_CLASS_MEM)) {
+			journal_cache_unwind(cache);
+
+			return -ENOMEM;
+		}
+
+		for (unsigned j = 0; j < n_larges; j++) {
+			journal_large_t	*large = &class->larges[j];
+
+			large->class = class;
+			large->data = &class->mem[j * class->size];
+			large->next_free = class->free;
+			class->free = large;
+		}
+
+		iovs[class->buf_index].iov_base = class->mem;
+		iovs[class->buf_index].iov_len = JOURNAL_LARGE_CLASS_MEM;
+	}
+
+	if (io_uring_register_buffers(iou_ring(iou), iovs, 1 + JOURNAL_LARGE_N_CLASSES) < 0)
+		fprintf(stderr, "Unable to register %zu byte buffer cache, continuing unregistered\n",
+			iovs[0].iov_len + JOURNAL_LARGE_N_CLASSES * JOURNAL_LARGE_CLASS_MEM);
+	else
+		cache->registered = 1;
+
+	return 0;
+}
+
+
+/* get a free large buffer of at least size bytes, NULL if there are none */
+static journal_large_t * large_get(uint64_t size)
+{
+	for (unsigned i = 0; i < JOURNAL_LARGE_N_CLASSES; i++) {
+		journal_large_class_t	*class = &journal_cache.large[i];
+		journal_large_t		*large;
+
+		if (class->size < size || !class->free)
+			continue;
+
+		large = class->free;
+		class->free = large->next_free;
+
+		return large;
+	}
+
+	return NULL;
+}
+
+
+static void large_put(void *pin)
+{
+	journal_large_t	*large = pin;
+
+	large->next_free = large->class->free;
+	large->class->free = large;
+}
+
+
+/* create an io reading length bytes @ offset of journal into large */
+static journal_io_t * large_io_new(_journal_t *_journal, journal_large_t *large, uint64_t offset, uint64_t length)
+{
+	journal_io_t	*io;
+
+	io = journal_io_new(_journal, journal_cache.registered ? IORING_OP_READ_FIXED : IORING_OP_READ, large->data, length, offset);
+	if (io)
+		io->buf_index = large->class->buf_index;
+
+	return io;
+}
+
+
+static inline journal_buf_t ** buf_bucket(_journal_t *_journal, uint64_t block)
+{
+	uint64_t	h;
+
+	h = ((uintptr_t)_journal >> 4) * UINT64_C(0x9e3779b97f4a7c15);
+	h ^= block * UINT64_C(0xc2b2ae3d27d4eb4f);
+	h ^= h >> 29;
+
+	return &journal_cache.buckets[h & (journal_cache.n_buckets - 1)];
+}
+
+
+/* find the buf caching block of journal, valid or pending, if any */
+static journal_buf_t * buf_find(_journal_t *_journal, uint64_t block)
+{
+	for (journal_buf_t *buf = *buf_bucket(_journal, block); buf; buf = buf->hash_next) {
+		if (buf->journal == _journal && buf->block == block)
+			return buf;
+	}
+
+	return NULL;
+}
+
+
+/* CLOCK sweep for a buf to reuse, NULL if they're all in flight or pinned */
+static journal_buf_t * buf_victim(void)
+{
+	journal_cache_t	*cache = &journal_cache;
+
+	for (unsigned n = 0; n < cache->n_bufs * 2; n++) {
+		journal_buf_t	*buf = &cache->bufs[cache->hand];
+
+		cache->hand = (cache->hand + 1) % cache->n_bufs;
+
+		if (buf->pending || buf->n_pins)
+			continue;
+
+		if (buf->referenced) {
+			buf->referenced = 0;
+			continue;
+		}
+
+		return buf;
+	}
+
+	return NULL;
+}
+
+
+/* remove buf from the bucket of the block it's caching */
+static void buf_unhash(journal_buf_t *buf)
+{
+	journal_buf_t	**b;
+
+	for (b = buf_bucket(buf->journal, buf->block); *b != buf; b = &(*b)->hash_next);
+	*b = buf->hash_next;
+	buf->journal = NULL;
+}
+
+
+/* move buf to caching block of journal */
+static void buf_rehash(journal_buf_t *buf, _journal_t *_journal, uint64_t block)
+{
+	journal_buf_t	**b;
+
+	if (buf->journal)
+		buf_unhash(buf);
+
+	buf->journal = _journal;
+	buf->block = block;
+	buf->valid = 0;
+
+	b = buf_bucket(_journal, block);
+	buf->hash_next = *b;
+	*b = buf;
+}
+
+
+/* Forget whatever's cached for a journal being closed, making the bufs
+ * first in line for reuse.  Its _journal_t is about to be freed, and the
+ * address may well come back as another journal's.
+ */
+static void buf_forget(_journal_t *_journal)
+{
+	for (unsigned i = 0; i < journal_cache.n_bufs; i++) {
+		journal_buf_t	*buf = &journal_cache.bufs[i];
+
+		if (buf->journal != _journal)
+			continue;
+
+		assert(!buf->pending && !buf->n_pins);
+
+		buf_unhash(buf);
+		buf->valid = buf->referenced = 0;
+	}
+}
+
+
+static void buf_unpin(void *pin)
+{
+	journal_buf_t	*buf = pin;
+
+	assert(buf->n_pins);
+
+	buf->n_pins--;
+}
+
+
+/* cache fill completed, replay the reads waiting on it */
+THUNK_DEFINE_STATIC(buf_got_fill, iou_t *, iou, journal_io_t *, io, journal_buf_t *, buf)
+{
+	journal_waiter_t	*waiters;
+
+	assert(iou);
+	assert(io);
+	assert(buf);
+
+	if (io->result < 0)
+		return io->result;
+
+	/* a short fill just leaves a shorter buf, waiters beyond it will find it
+	 * doesn't cover them and fall through to the unbuffered read
+	 */
+	buf->length = io->result;
+	buf->valid = 1;
+	buf->pending = 0;
+
+	waiters = buf->waiters;
+	buf->waiters = NULL;
+
+	return waiters_replay(iou, &buf->journal->public, waiters);
+}
+
+
+/* queue a fill of block of journal into buf */
+static int buf_fill(iou_t *iou, _journal_t *_journal, journal_buf_t *buf, uint64_t block)
+{
+	uint64_t	block_size = journal_cache.block_size;
+	journal_io_t	*io;
+
+	io = journal_io_new(_journal, journal_cache.registered ? IORING_OP_READ_FIXED : IORING_OP_READ,
+			    buf->data, block_size, block * block_size);
+	if (!io)
+		return -ENOMEM;
+
+	buf_rehash(buf, _journal, block);
+	buf->pending = 1;
+	buf->referenced = 1;
+
+	io->closure = THUNK(buf_got_fill(iou, io, buf));
+
+	return journal_io_submit(iou, io);
+}
+
+
+/* Look for offset+length in the buffer cache, filling any blocks missing.
+ * Ranges straddling two blocks are supported, as objects don't respect block
+ * boundaries, anything larger is left to the callers.
+ *
+ * Returns the number of valid bufs stored in bufs[] covering the range,
+ * 0 if the cache can't accommodate the range, -EINPROGRESS if the request
+ * has been queued as a waiter on a pending fill, or another < 0 on error.
+ */
+static int buf_lookup(iou_t *iou, _journal_t *_journal, uint64_t offset, uint64_t length, void *dest, journal_view_t *view, thunk_t *closure, journal_buf_t *bufs[2])
+{
+	uint64_t	block_size = journal_cache.block_size;
+	uint64_t	first, last;
+	journal_buf_t	*wait = NULL;
+	int		n = 0, r = 0;
+
+	if (!journal_cache.n_bufs)
+		return 0;
+
+	first = offset / block_size;
+	last = (offset + length - 1) / block_size;
+	if (last - first > 1)
+		return 0;
+
+	for (uint64_t block = first; block <= last && r >= 0; block++) {
+		journal_buf_t	*buf;
+		uint64_t	end;
+
+		buf = buf_find(_journal, block);
+		if (!buf) {
+			buf = buf_victim();
+			if (!buf)
+				break;
+
+			r = buf_fill(iou, _journal, buf, block);
+			if (r < 0)
+				break;
+		}
+
+		if (!buf->valid) {
+			if (!wait)
+				wait = buf;
+			continue;
+		}
+
+		/* a short buf from EOF, the range isn't all there */
+		end = offset + length;
+		if (end > (block + 1) * block_size)
+			end = (block + 1) * block_size;
+
+		if (end > block * block_size + buf->length)
+			break;
+
+		/* hold on to it so filling the other half can't claim it */
+		buf->referenced = 1;
+		buf->n_pins++;
+		bufs[n++] = buf;
+	}
+
+	if (!r && wait) {
+		r = waiter_add(&wait->waiters, offset, length, dest, view, closure);
+		if (!r)
+			r = -EINPROGRESS;
+	} else if (!r && n == last - first + 1)
+		r = n;
+
+	for (int i = 0; i < n; i++)
+		bufs[i]->n_pins--;
+
+	return r;
+}
+
+
+/* copy offset+length out of the n bufs covering it from buf_lookup() */
+static void buf_copy(journal_buf_t *bufs[2], int n, uint64_t offset, uint64_t length, void *dest)
+{
+	uint64_t	block_size = journal_cache.block_size;
+	uint64_t	first_length;
+
+	first_length = block_size - offset % block_size;
+	if (first_length > length)
+		first_length = length;
+
+	memcpy(dest, &bufs[0]->data[offset % block_size], first_length);
+	if (n > 1)
+		memcpy((uint8_t *)dest + first_length, bufs[1]->data, length - first_length);
+}
+
+
+THUNK_DEFINE_STATIC(got_read, iou_t *, iou, journal_io_t *, io, uint64_t, length, thunk_t *, closure)
+{
+	assert(iou);
+	assert(io);
+	assert(closure);
+
+	if (io->result < 0)
+		return io->result;
+
+	if (io->result < length)
+		return -EINVAL;
+
+	return thunk_end(thunk_dispatch(closure));
+}
+
+
+/* O_DIRECT counterpart to got_read(), the read landed in an aligned bounce
+ * buffer which dest gets copied out of.  The bounce buffer is a large buffer
+ * when one was available, otherwise a private allocation.
+ */
+THUNK_DEFINE_STATIC(got_direct_read, iou_t *, iou, journal_io_t *, io, uint64_t, offset, uint64_t, length, void *, dest, journal_large_t *, large, uint8_t *, bounce, thunk_t *, closure)
+{
+	uint64_t	skip = offset & (JOURNAL_DIRECT_ALIGN - 1);
+	int		r = io->result;
+
+	assert(iou);
+	assert(io);
+	assert(dest);
+	assert(bounce);
+	assert(closure);
+
+	if (r >= 0 && r < skip + length)
+		r = -EINVAL;
+
+	if (r >= 0)
+		memcpy(dest, &bounce[skip], length);
+
+	if (large)
+		large_put(large);
+	else
+		free(bounce);
+
+	if (r < 0)
+		return r;
+
+	return thunk_end(thunk_dispatch(closure));
+}
+
+
+/* queue an uncached read of journal opened O_DIRECT, which can't go straight
+ * into dest since neither it nor offset+length are likely to be aligned.
+ */
+static int journal_read_direct(iou_t *iou, _journal_t *_journal, uint64_t offset, uint64_t length, void *dest, thunk_t *closure)
+{
+	journal_large_t	*large;
+	uint64_t	start, end;
+	uint8_t		*bounce;
+	journal_io_t	*io;
+
+	start = offset & ~(uint64_t)(JOURNAL_DIRECT_ALIGN - 1);
+	end = (offset + length + JOURNAL_DIRECT_ALIGN - 1) & ~(uint64_t)(JOURNAL_DIRECT_ALIGN - 1);
+
+	large = large_get(end - start);
+	if (large)
+		bounce = large->data;
+	else if (posix_memalign((void **)&bounce, JOURNAL_DIRECT_ALIGN, end - start))
+		return -ENOMEM;
+
+	if (large)
+		io = large_io_new(_journal, large, start, end - start);
+	else
+		io = journal_io_new(_journal, IORING_OP_READ, bounce, end - start, start);
+
+	if (!io) {
+		if (large)
+			large_put(large);
+		else
+			free(bounce);
+
+		return -ENOMEM;
+	}
+
+	io->closure = THUNK(got_direct_read(iou, io, offset, length, dest, large, bounce, closure));
+
+	return journal_io_submit(iou, io);
+}
+
+
+/* a borrowed view holds its journal open until released */
+static void view_hold(_journal_t *_journal, journal_view_t *view)
+{
+	_journal->n_refs++;
+	view->journal = &_journal->public;
+}
+
+
+/* a large read for journal_borrow() landed, hand it to the view */
+THUNK_DEFINE_STATIC(borrow_got_large, iou_t *, iou, journal_io_t *, io, _journal_t *, _journal, journal_large_t *, large, uint64_t, skip, journal_view_t *, view, thunk_t *, closure)
+{
+	assert(iou);
+	assert(io);
+	assert(_journal);
+	assert(large);
+	assert(view);
+	assert(closure);
+
+	if (io->result < 0 || io->result < skip + view->length) {
+		large_put(large);
+
+		return io->result < 0 ? io->result : -EINVAL;
+	}
+
+	view->data = &large->data[skip];
+	view->unpin = large_put;
+	view->pin = large;
+	view_hold(_journal, view);
+
+	return thunk_end(thunk_dispatch(closure));
+}
+
+
+/* Queue a read of view's range into a free large buffer, which the view then
+ * keeps until released.  Returns 0 when none was available.
+ */
+static int borrow_large(iou_t *iou, _journal_t *_journal, journal_view_t *view, thunk_t *closure)
+{
+	journal_large_t	*large;
+	uint64_t	skip = 0, length = view->length;
+	journal_io_t	*io;
+	int		r;
+
+	/* O_DIRECT needs the read aligned, the view just skips the excess */
+	if (_journal->direct) {
+		skip = view->offset & (JOURNAL_DIRECT_ALIGN - 1);
+		length = (skip + length + JOURNAL_DIRECT_ALIGN - 1) & ~(uint64_t)(JOURNAL_DIRECT_ALIGN - 1);
+	}
+
+	large = large_get(length);
+	if (!large)
+		return 0;
+
+	io = large_io_new(_journal, large, view->offset - skip, length);
+	if (!io) {
+		large_put(large);
+
+		return -ENOMEM;
+	}
+
+	io->closure = THUNK(borrow_got_large(iou, io, _journal, large, skip, view, closure));
+	r = journal_io_submit(iou, io);
+	if (r < 0)
+		return r;
+
+	return 1;
+}
+
+
+/* read size bytes from offset offset in journal to dest, dispatch closure when done.
+ * for reads fitting within one or two blocks, the buffer cache shared by all
+ * journals is consulted and filled, if the data is present it's simply copied
+ * from there before dispatching closure.
+ * reads of any size covered by an active readahead window are served from it.
+ * journals opened with the JOURNAL_BACKEND_MMAP backend are served straight
+ * from their mapping instead.
+ * uncached reads of journals opened O_DIRECT go through an aligned bounce buffer.
+ */
+int journal_read(iou_t *iou, journal_t *journal, uint64_t offset, uint64_t length, void *dest, thunk_t *closure)
+{
+	_journal_t		*_journal = container_of(journal, _journal_t, public);
+	journal_ra_chunk_t	*chunk;
+	journal_buf_t		*bufs[2];
+	journal_io_t		*io;
+	int			r;
+
+	assert(iou);
+	assert(journal);
+	assert(length);
+	assert(dest);
+	assert(closure);
+
+	/* empty journals go unmapped, and have no buffer cache to fall back on */
+	if (_journal->map || journals_config.backend == JOURNAL_BACKEND_MMAP) {
+		/* same as a short read on the iou backend */
+		if (offset > _journal->map_size || length > _journal->map_size - offset)
+			return -EINVAL;
+
+		memcpy(dest, &_journal->map[offset], length);
+
+		return journal_dispatch(iou, _journal, closure);
+	}
+
+	chunk = ra_find(_journal, offset, length);
+	if (chunk) {
+		if (chunk->pending)
+			return waiter_add(&chunk->waiters, offset, length, dest, NULL, closure);
+
+		memcpy(dest, &chunk->data[offset - chunk->offset], length);
+
+		return journal_dispatch(iou, _journal, closure);
+	}
+
+	r = buf_lookup(iou, _journal, offset, length, dest, NULL, closure, bufs);
+	if (r > 0) {
+		buf_copy(bufs, r, offset, length, dest);
+
+		return journal_dispatch(iou, _journal, closure);
+	}
+
+	if (r == -EINPROGRESS)
+		return 0;
+
+	if (r < 0)
+		return r;
+
+	if (_journal->direct)
+		return journal_read_direct(iou, _journal, offset, length, dest, closure);
+
+	/* not cacheable, plain unbuffered read it into provided dest (assumed to be non-fixed)  */
+	io = journal_io_new(_journal, IORING_OP_READ, dest, length, offset);
+	if (!io)
+		return -ENOMEM;
+
+	io->closure = THUNK(got_read(iou, io, length, closure));
+
+	return journal_io_submit(iou, io);
+}
+
+
+/* Borrow a read-only view of length bytes from offset offset in journal
+ * into *view, dispatch closure when it's ready.
+ *
+ * Unlike journal_read() nothing gets copied, view->data points directly into
+ * the journal's mapping, readahead window, or the buffer cache, in raw on-disk
+ * form, which stays pinned there until journal_view_release().  Ranges too
+ * large for the buffer cache get read into one of the registered large
+ * buffers, only when those are exhausted or outsized does the view get a
+ * private copy.
+ *
+ * Views should be released promptly, as a pinned buffer can't be reused for
+ * anything else in the meantime.
+ */
+int journal_borrow(iou_t *iou, journal_t *journal, uint64_t offset, uint64_t length, journal_view_t *view, thunk_t *closure)
+{
+	_journal_t		*_journal = container_of(journal, _journal_t, public);
+	journal_ra_chunk_t	*chunk;
+	journal_buf_t		*bufs[2];
+	void			*copy;
+	int			r;
+
+	assert(iou);
+	assert(journal);
+	assert(length);
+	assert(view);
+	assert(closure);
+
+	view->offset = offset;
+	view->length = length;
+	view->unpin = NULL;
+	view->pin = NULL;
+	view->journal = NULL;
+
+	if (_journal->map || journals_config.backend == JOURNAL_BACKEND_MMAP) {
+		if (offset > _journal->map_size || length > _journal->map_size - offset)
+			return -EINVAL;
+
+		view->data = &_journal->map[offset];
+		view_hold(_journal, view);
+
+		return journal_dispatch(iou, _journal, closure);
+	}
+
+	chunk = ra_find(_journal, offset, length);
+	if (chunk) {
+		if (chunk->pending)
+			return waiter_add(&chunk->waiters, offset, length, NULL, view, closure);
+
+		chunk->n_pins++;
+		chunk->ra->n_pins++;
+		view->data = &chunk->data[offset - chunk->offset];
+		view->unpin = ra_chunk_unpin;
+		view->pin = chunk;
+		view_hold(_journal, view);
+
+		return journal_dispatch(iou, _journal, closure);
+	}
+
+	r = buf_lookup(iou, _journal, offset, length, NULL, view, closure, bufs);
+	if (r == 1) {
+		bufs[0]->n_pins++;
+		view->data = &bufs[0]->data[offset % journal_cache.block_size];
+		view->unpin = buf_unpin;
+		view->pin = bufs[0];
+		view_hold(_journal, view);
+
+		return journal_dispatch(iou, _journal, closure);
+	}
+
+	if (r == -EINPROGRESS)
+		return 0;
+
+	if (r < 0)
+		return r;
+
+	/* too large for the cache, read it into a registered large buffer */
+	if (r == 0 && length > journal_cache.block_size) {
+		r = borrow_large(iou, _journal, view, closure);
+		if (r)
+			return r < 0 ? r : 0;
+	}
+
+	/* the view owns a private copy, which for a straddled range is
+	 * assembled from the two bufs already at hand.
+	 */
+	copy = malloc(length);
+	if (!copy)
+		return -ENOMEM;
+
+	view->data = copy;
+	view->unpin = free;
+	view->pin = copy;
+	view_hold(_journal, view);
+
+	if (r == 2) {
+		buf_copy(bufs, r, offset, length, copy);
+
+		return journal_dispatch(iou, _journal, closure);
+	}
+
+	return journal_read(iou, journal, offset, length, copy, closure);
+}
+
+
+/* release a view borrowed via journal_borrow(), view->data is no longer valid after this */
+void journal_view_release(journal_view_t *view)
+{
+	assert(view);
+
+	if (view->unpin)
+		view->unpin(view->pin);
+
+	if (view->journal)
+		(void) journal_unref(container_of(view->journal, _journal_t, public));
+
+	view->unpin = NULL;
+	view->pin = NULL;
+	view->journal = NULL;
+	view->data = NULL;
+}
+
+
+/* map the opened journal for JOURNAL_BACKEND_MMAP, returns < 0 on error */
+static int journal_map(_journal_t *_journal)
+{
+	void	*map;
+
+	/* empty files can't be mapped, journal_read() finds reads of them short */
+	if (!_journal->public.size)
+		return 0;
+
+	map = mmap(NULL, _journal->public.size, PROT_READ, MAP_SHARED, _journal->public.fd, 0);
+	if (map == MAP_FAILED)
+		return -errno;
+
+	_journal->map = map;
+	_journal->map_size = _journal->public.size;
+
+	return 0;
+}
+
+
+/* For journals_config.cache_neutral, switch an opened journal to O_DIRECT so
+ * reading it bypasses the page cache entirely.  Journals on filesystems
+ * refusing O_DIRECT are left to journal_dontneed() instead.
+ */
+static void journal_set_direct(_journal_t *_journal)
+{
+	int	flags;
+
+	flags = fcntl(_journal->public.fd, F_GETFL);
+	if (flags < 0 || fcntl(_journal->public.fd, F_SETFL, flags | O_DIRECT) < 0)
+		return;
+
+	_journal->direct = 1;
+}
+
+
+THUNK_DEFINE_STATIC(dontneed_done, journal_io_t *, io)
+{
+	assert(io);
+
+	/* it's only advice, failing to take it is no reason to stop */
+	return 0;
+}
+
+
+/* For journals_config.cache_neutral journals which couldn't be opened
+ * O_DIRECT, drop the page cache behind a sequential scan now at offset, in
+ * JOURNAL_DONTNEED_CHUNK steps unless finishing.  Online journals are left
+ * alone, journald and its readers are actively using those.
+ */
+static int journal_dontneed(iou_t *iou, _journal_t *_journal, Header *header, uint64_t offset, int finish)
+{
+	uint64_t	start = _journal->dontneed, end;
+	journal_io_t	*io;
+
+	if (!journals_config.cache_neutral || _journal->direct || header->state != STATE_ARCHIVED)
+		return 0;
+
+	end = offset;
+	if (!finish) {
+		end &= ~(uint64_t)(JOURNAL_DIRECT_ALIGN - 1);
+		if (end < start + JOURNAL_DONTNEED_CHUNK)
+			return 0;
+	}
+
+	if (end <= start)
+		return 0;
+
+	_journal->dontneed = end;
+
+	/* mapped pages need unmapping before the page cache will let go of them */
+	if (_journal->map) {
+		if (start < _journal->map_size)
+			(void) madvise(_journal->map + start, (end < _journal->map_size ? end : _journal->map_size) - start, MADV_DONTNEED);
+		(void) posix_fadvise(_journal->public.fd, start, end - start, POSIX_FADV_DONTNEED);
+
+		return 0;
+	}
+
+	io = journal_io_new(_journal, IORING_OP_FADVISE, NULL, end - start, start);
+	if (!io)
+		return -ENOMEM;
+
+	io->advice = POSIX_FADV_DONTNEED;
+	io->closure = THUNK(dontneed_done(io));
+
+	return journal_io_submit(iou, io);
+}
+
+
+static int journals_open_next(journals_t *journals);
+
+
+/* a journal is done with, successfully opened and scanned or not, make room for the next one */
+static int journal_finished(journals_t *journals)
+{
+	journals->n_open--;
+
+	return journals_open_next(journals);
+}
+
+
+/* Close a journal nothing references anymore, as its scan has finished,
+ * returning its slot to the window and freeing it.
+ */
+static int journal_close(_journal_t *_journal)
+{
+	journals_t	*journals = _journal->journals;
+	journal_t	*journal = &_journal->public;
+	journal_dev_t	*dev = _journal->dev;
+	thunk_t		*on_abandon = _journal->on_abandon;
+	int		fd = -1, r;
+
+	assert(!_journal->n_refs);
+
+	if (on_abandon && !_journal->abandoned) {
+		thunk_free(on_abandon);
+		on_abandon = NULL;
+	}
+
+	journal_readahead_release(_journal);
+
+	if (_journal->map) {
+		munmap(_journal->map, _journal->map_size);
+		_journal->map = NULL;
+	}
+
+	/* the registered file holds its own reference, drop it too */
+	(void) io_uring_register_files_update(iou_ring(journals->iou), journal->idx, &fd, 1);
+	journals->free_slots[journals->n_free_slots++] = journal->idx;
+
+	close(journal->fd);
+
+	free(_journal->extents);
+	buf_forget(_journal);
+	for (unsigned i = 0; i < 2; i++) {
+		if (_journal->iter_steps[i])
+			thunk_free(_journal->iter_steps[i]);
+	}
+	free(_journal);
+
+	/* the device stream goes to whichever journal gets claimed next */
+	dev->n_streams--;
+
+	/* nothing's in flight for the journal anymore, its owner can clean up after the abandoned chain */
+	if (on_abandon) {
+		r = thunk_dispatch(on_abandon);
+		if (r > 0)
+			thunk_free(on_abandon);
+		else if (r < 0)
+			return r;
+	}
+
+	return journal_finished(journals);
+}
+
+
+/* Register closure for dispatch once journal is closed, should it be
+ * abandoned as invalid, replacing any closure registered before it.  A
+ * journal's chain of closures just ends when it's abandoned, closure is
+ * for tearing down whatever the chain would have on finishing, which
+ * should then register NULL.  If the journal isn't abandoned closure is
+ * freed undispatched.
+ */
+void journal_on_abandon(journal_t *journal, thunk_t *closure)
+{
+	_journal_t	*_journal = container_of(journal, _journal_t, public);
+
+	if (_journal->on_abandon)
+		thunk_free(_journal->on_abandon);
+
+	_journal->on_abandon = closure;
+}
+
+
+/* Load the journal's extent map for ordering its ios by physical offset,
+ * failing just leaves them in file order.  There's no io_uring op for this,
+ * so it's run via iou_async(), on rotational devices only.  Nothing else
+ * touches the journal until it's started once this finishes.
+ */
+THUNK_DEFINE_STATIC(journal_load_extents, _journal_t *, _journal)
+{
+	struct fiemap	probe = { .fm_length = FIEMAP_MAX_OFFSET };
+	struct fiemap	*fm;
+
+	if (ioctl(_journal->public.fd, FS_IOC_FIEMAP, &probe) < 0 || !probe.fm_mapped_extents)
+		return 0;
+
+	fm = calloc(1, sizeof(*fm) + sizeof(fm->fm_extents[0]) * probe.fm_mapped_extents);
+	if (!fm)
+		return 0;
+
+	fm->fm_length = FIEMAP_MAX_OFFSET;
+	fm->fm_extent_count = probe.fm_mapped_extents;
+	if (ioctl(_journal->public.fd, FS_IOC_FIEMAP, fm) < 0) {
+		free(fm);
+		return 0;
+	}
+
+	_journal->extents = fm;
+
+	return 0;
+}
+
+
+/* start scanning an opened journal in its device stream, handing it to the journals_for_each() closure */
+static int journal_start(_journal_t *_journal)
+{
+	journals_t	*journals = _journal->journals;
+	int		r;
+
+	/* hold the journal across the dispatch, whatever it queues keeps it open from there */
+	_journal->n_refs++;
+
+	*journals->journal_iter = &_journal->public;
+	r = journal_abandon(_journal, thunk_dispatch(journals->closure));
+	if (r < 0)
+		return r;
+
+	return journal_unref(_journal);
+}
+
+
+/* start a journal once its extents are loaded */
+THUNK_DEFINE_STATIC(loaded_extents, _journal_t *, _journal)
+{
+	return thunk_end(journal_start(_journal));
+}
+
+
+/* statx of an opened journal completed, store its metadata in the journal_t,
+ * finish setting it up in a free slot of the registered file table and start it.
+ */
+THUNK_DEFINE_STATIC(got_journal_statx, iou_t *, iou, iou_op_t *, op, journals_t *, journals, _journal_t *, _journal, struct statx *, stx)
+{
+	journal_t	*journal = &_journal->public;
+	int		r;
+
+	assert(iou);
+	assert(op);
+	assert(journals);
+	assert(_journal);
+	assert(stx);
+
+	if (op->result < 0) {
+		free(stx);
+		return op->result;
+	}
+
+	journal->size = stx->stx_size;
+	_journal->bound = stx->stx_size;
+	journal->blocks = stx->stx_blocks;
+	journal->ino = stx->stx_ino;
+	journal->mtime.tv_sec = stx->stx_mtime.tv_sec;
+	journal->mtime.tv_nsec = stx->stx_mtime.tv_nsec;
+	_journal->blksize = stx->stx_blksize;
+	free(stx);
+
+	if (journals_config.backend == JOURNAL_BACKEND_MMAP) {
+		r = journal_map(_journal);
+		if (r < 0)
+			return r;
+	} else {
+		if (journals_config.cache_neutral)
+			journal_set_direct(_journal);
+
+		/* sized for the first journal's filesystem */
+		r = journal_cache_init(iou, _journal->blksize);
+		if (r < 0)
+			return r;
+	}
+
+	assert(journals->n_free_slots);
+	journal->idx = journals->free_slots[--journals->n_free_slots];
+
+	r = io_uring_register_files_update(iou_ring(iou), journal->idx, &journal->fd, 1);
+	if (r < 0)
+		return r;
+
+	if (_journal->dev->rotational && !_journal->map)
+		return	thunk_end(iou_async(iou, (int(*)(void *))thunk_dispatch, THUNK(
+				journal_load_extents(_journal)),
+					(int(*)(void *))thunk_dispatch, THUNK(
+						loaded_extents(_journal))));
+
+	return journal_start(_journal);
+}
+
+
+/* an open on journal->name was attempted, result in op->result.
+ * when successful, queue a statx of the opened journal to continue with,
+ * otherwise it's simply finished.
+ */
+THUNK_DEFINE_STATIC(opened_journal, iou_t *, iou, iou_op_t *, op, journals_t *, journals, _journal_t *, _journal)
+{
+	journal_t	*journal = &_journal->public;
+	struct statx	*stx;
+	iou_op_t	*sop;
+
+	assert(iou);
+	assert(op);
+	assert(journals);
+	assert(_journal);
+
+	if (op->result < 0 ) {
+		if (op->result != -EPERM && op->result != -EACCES)
+			return op->result;
+
+		fprintf(stderr, "Permission denied opening \"%s\", ignoring\n", journal->name);
+		_journal->dev->n_streams--;
+		free(_journal);
+
+		return journal_finished(journals);
+	}
+
+	journal->fd = op->result;
+
+	stx = malloc(sizeof(*stx));
+	if (!stx)
+		return -ENOMEM;
+
+	sop = journal_op_new(iou);
+	if (!sop) {
+		free(stx);
+		return -ENOMEM;
+	}
+
+	io_uring_prep_statx(sop->sqe, journal->fd, "", AT_EMPTY_PATH, STATX_SIZE|STATX_BLOCKS|STATX_INO|STATX_MTIME, stx);
+	op_queue(iou, sop, THUNK(got_journal_statx(iou, sop, journals, _journal, stx)));
+
+	return 0;
+}
+
+
+/* Claim the next journal to open, from a device with a stream to spare,
+ * taking the stream.  Journals on devices with all their streams taken are
+ * left unclaimed, rather than occupying the window while waiting their turn.
+ * Exclusive devices are only claimed from by the job owning them, and a job
+ * only takes ownership of another while owning less than its share of those
+ * still being scanned.
+ * Returns 1 with the journal's index in names[] and device in *res_n and
+ * *res_dev, or 0 when there's nothing to claim for now.
+ */
+static int journals_claim(journals_t *journals, size_t *res_n, journal_dev_t **res_dev)
+{
+	journals_found_t	*found = journals->found;
+	unsigned		jobs = journals_config.jobs ? journals_config.jobs : 1;
+	size_t			share = (found->n_exclusive + jobs - 1) / jobs;
+	size_t			n_owned = 0;
+
+	for (size_t i = 0; i < found->n_devs; i++) {
+		journals_found_dev_t	*fdev = &found->devs[i];
+
+		if (__atomic_load_n(&fdev->owner, __ATOMIC_ACQUIRE) == journals &&
+		    __atomic_load_n(&fdev->n_next, __ATOMIC_RELAXED) < fdev->n_journals)
+			n_owned++;
+	}
+
+	for (size_t i = 0; i < found->n_devs; i++) {
+		journals_found_dev_t	*fdev = &found->devs[i];
+		journal_dev_t		*dev;
+		size_t			n;
+
+		if (__atomic_load_n(&fdev->n_next, __ATOMIC_RELAXED) >= fdev->n_journals)
+			continue;
+
+		if (fdev->exclusive) {
+			journals_t	*owner = __atomic_load_n(&fdev->owner, __ATOMIC_ACQUIRE);
+
+			if (owner && owner != journals)
+				continue;
+
+			if (!owner) {
+				if (n_owned >= share)
+					continue;
+
+				if (!__atomic_compare_exchange_n(&fdev->owner, &owner, journals, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+					continue;
+
+				n_owned++;
+			}
+		}
+
+		dev = journal_dev_get(fdev->dev, fdev->rotational);
+		if (!dev)
+			return -ENOMEM;
+
+		if (dev->max_streams && dev->n_streams >= dev->max_streams)
+			continue;
+
+		n = __atomic_fetch_add(&fdev->n_next, 1, __ATOMIC_RELAXED);
+		if (n >= fdev->n_journals)
+			continue;
+
+		dev->n_streams++;
+		*res_n = fdev->journals[n];
+		*res_dev = dev;
+
+		return 1;
+	}
+
+	return 0;
+}
+
+
+/* Claim and queue opening journals until the window is full or there are
+ * none left to claim, once this job has none left open the closure is done.
+ */
+static int journals_open_next(journals_t *journals)
+{
+	journals_found_t	*found = journals->found;
+	iou_t			*iou = journals->iou;
+
+	while (journals->n_open < journals->window) {
+		_journal_t	*_journal;
+		journal_dev_t	*dev;
+		iou_op_t	*op;
+		size_t		n;
+		int		r;
+
+		r = journals_claim(journals, &n, &dev);
+		if (r < 0)
+			return r;
+
+		if (!r)
+			break;
+
+		/* only claimed journals get allocated, so memory follows the window and not the journals found */
+		_journal = calloc(1, sizeof(*_journal));
+		if (!_journal)
+			return -ENOMEM;
+
+		_journal->public.name = found->names[n];
+		_journal->public.fd = -1;
+		_journal->journals = journals;
+		_journal->dev = dev;
+		_journal->n = n;
+		journals->n_open++;
+
+		op = journal_op_new(iou);
+		if (!op)
+			return -ENOMEM;
+
+		io_uring_prep_openat(op->sqe, AT_FDCWD, _journal->public.name, journals->flags, 0);
+		op_queue(iou, op, THUNK(opened_journal(iou, op, journals, _journal)));
+	}
+
+	if (!journals->n_open && journals->closure) {
+		thunk_free(journals->closure);
+		journals->closure = NULL;
+	}
+
+	return 0;
+}
+
+
+/* does name look like a journal file, online (.journal) or dirty (.journal~)? */
+static int journal_name_valid(const char *name)
+{
+	static const char	*suffixes[] = { ".journal", ".journal~" };
+	size_t			len = strlen(name);
+
+	if (name[0] == '.')	/* just skip dot files and "." ".." */
+		return 0;
+
+	for (int i = 0; i < sizeof(suffixes) / sizeof(*suffixes); i++) {
+		size_t	slen = strlen(suffixes[i]);
+
+		if (len > slen && !strcmp(name + len - slen, suffixes[i]))
+			return 1;
+	}
+
+	return 0;
+}
+
+
+/* append a journal named name to *found, allocating or growing it as
+ * needed.  name becomes owned by *found.
+ */
+static int journals_add(journals_found_t **found, char *name)
+{
+	journals_found_t	*j = *found;
+
+	if (!j || j->n_journals == j->n_allocated) {
+		size_t	n = j ? j->n_allocated * 2 : JOURNALS_ALLOC_MIN;
+		size_t	o = j ? j->n_allocated : 0;
+
+		j = realloc(j, sizeof(journals_found_t) + sizeof(j->names[0]) * n);
+		if (!j) {
+			free(name);
+			return -ENOMEM;
+		}
+
+		if (!o)
+			memset(j, 0, sizeof(*j));
+		j->n_allocated = n;
+		*found = j;
+	}
+
+	j->names[j->n_journals++] = name;
+
+	return 0;
+}
+
+
+/* free found and everything it owns, found may be NULL */
+static void journals_found_free(journals_found_t *found)
+{
+	if (!found)
+		return;
+
+	for (size_t i = 0; i < found->n_journals; i++)
+		free(found->names[i]);
+
+	free(found->devs);
+	free(found->dev_journals);
+	free(found);
+}
+
+
+/* add the journals found in directory path to *found, a missing directory is simply empty */
+static int journals_add_dir(journals_found_t **found, const char *path)
+{
+	struct dirent	*dent;
+	DIR		*dir;
+	int		r = 0;
+
+	/* I don't see any readdir/getdents ops for io_uring, so just do the opendir/readdir
+	 * synchronously here before queueing the opening of all those paths.
+	 */
+	dir = opendir(path);
+	if (!dir)
+		return errno == ENOENT ? 0 : -errno;
+
+	while (r >= 0 && (dent = readdir(dir))) {
+		char	*name;
+
+		if (!journal_name_valid(dent->d_name))
+			continue;
+
+		if (asprintf(&name, "%s/%s", path, dent->d_name) < 0) {
+			r = -ENOMEM;
+			break;
+		}
+
+		r = journals_add(found, name);
+	}
+
+	closedir(dir);
+
+	return r;
+}
+
+
+/* Add the journals found at root to *found, root being a directory of
+ * journals, a journal file, or a glob pattern matching any of those.
+ * Files named explicitly or by pattern are taken as-is, only directory
+ * contents are filtered by name.
+ */
+static int journals_add_root(journals_found_t **found, const char *root)
+{
+	glob_t	g;
+	int	r;
+
+	r = glob(root, GLOB_BRACE, NULL, &g);
+	if (r == GLOB_NOMATCH)
+		return 0;
+
+	if (r != 0)
+		return r == GLOB_NOSPACE ? -ENOMEM : -EIO;
+
+	r = 0;
+	for (size_t i = 0; r >= 0 && i < g.gl_pathc; i++) {
+		struct stat	st;
+		char		*name;
+
+		if (stat(g.gl_pathv[i], &st) < 0) {
+			fprintf(stderr, "Unable to stat \"%s\", ignoring: %s\n", g.gl_pathv[i], strerror(errno));
+			continue;
+		}
+
+		if (S_ISDIR(st.st_mode)) {
+			r = journals_add_dir(found, g.gl_pathv[i]);
+			continue;
+		}
+
+		name = strdup(g.gl_pathv[i]);
+		if (!name) {
+			r = -ENOMEM;
+			break;
+		}
+
+		r = journals_add(found, name);
+	}
+
+	globfree(&g);
+
+	return r;
+}
+
+
+/* Size the window of journals open at once, from journals_config.window or
+ * otherwise RLIMIT_NOFILE, divided among the jobs.
+ */
+static int journals_window_init(journals_t *journals)
+{
+	struct rlimit	rlim;
+	unsigned	window = journals_config.window;
+	unsigned	jobs = journals_config.jobs ? journals_config.jobs : 1;
+
+	if (!window) {
+		window = JOURNALS_WINDOW_DEFAULT;
+
+		/* leave plenty of descriptors for everything else */
+		if (!getrlimit(RLIMIT_NOFILE, &rlim) && rlim.rlim_cur != RLIM_INFINITY && rlim.rlim_cur / 2 < window)
+			window = rlim.rlim_cur / 2;
+	}
+
+	window /= jobs;
+	if (window > journals->found->n_journals)
+		window = journals->found->n_journals;
+	if (!window)
+		window = 1;
+
+	journals->free_slots = malloc(sizeof(*journals->free_slots) * window);
+	if (!journals->free_slots)
+		return -ENOMEM;
+
+	journals->window = journals->n_free_slots = window;
+	for (unsigned i = 0; i < window; i++)
+		journals->free_slots[i] = window - 1 - i;
+
+	return 0;
+}
+
+
+/* Register a sparse file table the size of the window on the job's ring,
+ * this must follow any iou_resize(), which replaces the ring and with it
+ * anything registered.
+ */
+static int journals_window_register(journals_t *journals)
+{
+	unsigned	window = journals->window;
+	int		r;
+
+	r = io_uring_register_files_sparse(iou_ring(journals->iou), window);
+	if (r < 0) {
+		int	*fds;
+
+		/* older kernels lack sparse registration, but accept -1 placeholders */
+		fds = malloc(sizeof(*fds) * window);
+		if (!fds)
+			return -ENOMEM;
+
+		for (unsigned i = 0; i < window; i++)
+			fds[i] = -1;
+
+		r = io_uring_register_files(iou_ring(journals->iou), fds, window);
+		free(fds);
+	}
+
+	return r < 0 ? r : 0;
+}
+
+
+/* Find the journals in journals_config.paths, or when none are configured
+ * the persistent and volatile journal directories for machid.
+ */
+typedef struct journal_file_id_t {
+	dev_t	dev;
+	ino_t	ino;
+	size_t	idx;
+} journal_file_id_t;
+
+/* the device of journals which couldn't be stat()ed, left for opening to complain about */
+#define JOURNAL_DEV_UNKNOWN	((dev_t)-1)
+
+
+static int journal_file_id_cmp(const void *a, const void *b)
+{
+	const journal_file_id_t	*x = a, *y = b;
+
+	if (x->dev != y->dev)
+		return x->dev < y->dev ? -1 : 1;
+
+	if (x->ino != y->ino)
+		return x->ino < y->ino ? -1 : 1;
+
+	return x->idx < y->idx ? -1 : x->idx > y->idx;
+}
+
+
+/* like journal_file_id_cmp(), but ignoring the inode to group by device in the order found */
+static int journal_file_dev_cmp(const void *a, const void *b)
+{
+	const journal_file_id_t	*x = a, *y = b;
+
+	if (x->dev != y->dev)
+		return x->dev < y->dev ? -1 : 1;
+
+	return x->idx < y->idx ? -1 : x->idx > y->idx;
+}
+
+
+/* Index the journals found by the devices they reside on, for claiming
+ * them per device in journals_claim().  This is also where journals found
+ * more than once get dropped, as overlapping paths or globs would
+ * otherwise have them scanned and counted twice, the first name found for
+ * a file is kept, in the order found.  It's all synchronous, like the rest
+ * of discovery.
+ */
+static int journals_index(journals_found_t *found)
+{
+	journal_file_id_t	*ids;
+	size_t			*pos;
+	size_t			n_ids = 0, n = 0;
+
+	if (!found)
+		return 0;
+
+	ids = malloc(sizeof(*ids) * found->n_journals);
+	pos = malloc(sizeof(*pos) * found->n_journals);
+	if (!ids || !pos) {
+		free(ids);
+		free(pos);
+		return -ENOMEM;
+	}
+
+	for (size_t i = 0; i < found->n_journals; i++) {
+		struct stat	st;
+
+		ids[i].dev = JOURNAL_DEV_UNKNOWN;
+		ids[i].ino = 0;
+		ids[i].idx = i;
+
+		if (stat(found->names[i], &st) < 0)
+			continue;
+
+		ids[i].dev = st.st_dev;
+		ids[i].ino = st.st_ino;
+	}
+
+	qsort(ids, found->n_journals, sizeof(*ids), journal_file_id_cmp);
+
+	for (size_t i = 0; i < found->n_journals; i++) {
+		if (i && ids[i].dev != JOURNAL_DEV_UNKNOWN &&
+		    ids[i].dev == ids[i - 1].dev && ids[i].ino == ids[i - 1].ino) {
+			free(found->names[ids[i].idx]);
+			found->names[ids[i].idx] = NULL;
+			continue;
+		}
+
+		ids[n_ids++] = ids[i];
+	}
+
+	/* compact the names, noting where each went */
+	for (size_t i = 0; i < found->n_journals; i++) {
+		if (!found->names[i])
+			continue;
+
+		pos[i] = n;
+		found->names[n++] = found->names[i];
+	}
+	found->n_journals = n;
+
+	for (size_t i = 0; i < n_ids; i++)
+		ids[i].idx = pos[ids[i].idx];
+	free(pos);
+
+	qsort(ids, n_ids, sizeof(*ids), journal_file_dev_cmp);
+
+	found->n_devs = 0;
+	for (size_t i = 0; i < n_ids; i++) {
+		if (!i || ids[i].dev != ids[i - 1].dev)
+			found->n_devs++;
+	}
+
+	found->devs = calloc(found->n_devs, sizeof(*found->devs));
+	found->dev_journals = malloc(sizeof(*found->dev_journals) * n_ids);
+	if (!found->devs || !found->dev_journals) {
+		free(found->devs);
+		free(found->dev_journals);
+		found->devs = NULL;
+		found->dev_journals = NULL;
+		found->n_devs = 0;
+		free(ids);
+		return -ENOMEM;
+	}
+
+	for (size_t i = 0, d = 0; i < n_ids; i++) {
+		journals_found_dev_t	*dev = &found->devs[d];
+
+		if (i && ids[i].dev != ids[i - 1].dev)
+			dev = &found->devs[++d];
+
+		if (!dev->journals) {
+			dev->dev = ids[i].dev;
+			dev->rotational = ids[i].dev != JOURNAL_DEV_UNKNOWN && journal_dev_rotational(ids[i].dev);
+			dev->exclusive = dev->rotational || journals_config.device_streams || journals_config.device_queue_depth;
+			dev->journals = &found->dev_journals[i];
+			found->n_exclusive += dev->exclusive;
+		}
+
+		found->dev_journals[i] = ids[i].idx;
+		dev->n_journals++;
+	}
+
+	free(ids);
+
+	return 0;
+}
+
+
+static int journals_discover(const char *machid, journals_found_t **found)
+{
+	journals_found_t	*j = NULL;
+	int			r = 0;
+
+	if (journals_config.n_paths) {
+		for (unsigned i = 0; i < journals_config.n_paths && r >= 0; i++)
+			r = journals_add_root(&j, journals_config.paths[i]);
+	} else {
+		static const char	*defaults[] = { PERSISTENT_PATH, VOLATILE_PATH };
+
+		for (int i = 0; i < sizeof(defaults) / sizeof(*defaults) && r >= 0; i++) {
+			char	*path;
+
+			if (asprintf(&path, "%s/%s", defaults[i], machid) < 0) {
+				r = -ENOMEM;
+				break;
+			}
+
+			r = journals_add_dir(&j, path);
+			free(path);
+		}
+	}
+
+	if (r >= 0)
+		r = journals_index(j);
+
+	if (r < 0) {
+		journals_found_free(j);
+		return r;
+	}
+
+	*found = j;
+
+	return 0;
+}
+
+
+/* Request opening the journals via iou, allocating the resulting journals_t @ *journals.
+ *
+ * Discovery itself is synchronous and done once, by the first job to get
+ * here, closure is dispatched once it's done.  Every job calling this
+ * shares the journals discovered, but opens them on its own iou as its
+ * journals_for_each() claims them.  No journals found leaves *journals
+ * untouched without dispatching closure.
+ */
+/* returns < 0 on error, 0 on successful queueing of operation */
+THUNK_DEFINE(journals_open, iou_t *, iou, char **, machid, int, flags, journals_t **, journals, thunk_t *, closure)
+{
+	journals_t	*j;
+	int		r = 0;
+
+	assert(iou);
+	assert(machid);
+	assert(journals);
+	assert(closure);
+
+	pthread_mutex_lock(&journals_found_lock);
+	if (!journals_discovered) {
+		r = journals_discover(*machid, &journals_found);
+		journals_discovered = (r >= 0);
+	}
+	pthread_mutex_unlock(&journals_found_lock);
+	if (r < 0)
+		return r;
+
+	if (!journals_found)	/* no journals! */
+		return 0;
+
+	j = calloc(1, sizeof(*j));
+	if (!j)
+		return -ENOMEM;
+
+	j->iou = iou;
+	j->found = journals_found;
+	j->flags = flags;
+
+	r = journals_window_init(j);
+	if (r < 0)
+		return r;	/* TODO: cleanup j */
+
+	/* the ring only needs room for the admitted I/O and an open or statx per journal in the window,
+	 * anything more waits its turn in journal_io_admit() or journal_op_new().
+	 */
+	r = iou_resize(iou, journals_config.queue_depth + j->window);
+	if (r < 0)
+		return r;	/* TODO: cleanup j */
+
+	r = journals_window_register(j);
+	if (r < 0)
+		return r;	/* TODO: cleanup j */
+
+	/* stow the journals where they can be found, but note they aren't opened
+	 * yet, that's left to journals_for_each().
+	 */
+	*journals = j;
+
+	return thunk_end(thunk_dispatch(closure));
+}
+
+
+
+/* Everything loaded from a journal gets checked against the journal and
+ * its own size before anything uses it, with nothing more than a handful
+ * of comparisons it's cheap enough to always be on.  What's found invalid
+ * is reported, and the loader fails with -EUCLEAN, abandoning the journal
+ * rather than the run: the dispatch of its I/O swallows -EUCLEAN, ending
+ * the journal's chain of closures without error, see journal_abandon().
+ */
+static int journal_invalid(journal_t *journal, uint64_t offset, const char *what)
+{
+	fprintf(stderr, "Journal \"%s\" has %s @ %"PRIu64", ignoring\n", journal->name, what, offset);
+
+	return -EUCLEAN;
+}
+
+
+/* the fixed part of each object type and the size of its items, if it ends in any */
+static const struct {
+	uint64_t	min_size, item_size;
+} journal_object_layouts[_OBJECT_TYPE_MAX] = {
+	[OBJECT_DATA] =			{ offsetof(DataObject, payload) + 1 },
+	[OBJECT_FIELD] =		{ offsetof(FieldObject, payload) + 1 },
+	[OBJECT_ENTRY] =		{ offsetof(EntryObject, items), sizeof(EntryItem) },
+	[OBJECT_DATA_HASH_TABLE] =	{ offsetof(HashTableObject, items), sizeof(HashItem) },
+	[OBJECT_FIELD_HASH_TABLE] =	{ offsetof(HashTableObject, items), sizeof(HashItem) },
+	[OBJECT_ENTRY_ARRAY] =		{ offsetof(EntryArrayObject, items), sizeof(le64_t) },
+	[OBJECT_TAG] =			{ sizeof(TagObject) },
+};
+
+
+/* Objects are bounded by the file as stat'd when opened, unless it's online,
+ * then it may have grown since and its header's arena is trusted for what's
+ * been allocated, see got_header().
+ */
+static inline uint64_t journal_bound(journal_t *journal)
+{
+	_journal_t	*_journal = container_of(journal, _journal_t, public);
+
+	return _journal->bound;
+}
+
+
+/* is the extent of an object of size @ offset plausible, enough to skip over it */
+static int object_extent_valid(journal_t *journal, uint64_t offset, uint64_t size)
+{
+	uint64_t	bound = journal_bound(journal);
+
+	return	!(offset & 7) &&
+		size >= sizeof(ObjectHeader) &&
+		offset < bound &&
+		size <= bound - offset;
+}
+
+
+/* check an object of type and size (host order) @ offset fits journal and its type, returns < 0 if not */
+static int object_check(journal_t *journal, uint64_t offset, uint8_t type, uint64_t size)
+{
+	if (!object_extent_valid(journal, offset, size))
+		return journal_invalid(journal, offset, "an object out of bounds");
+
+	if (type == OBJECT_UNUSED || type >= _OBJECT_TYPE_MAX)
+		return journal_invalid(journal, offset, "an object of unknown type");
+
+	if (size < journal_object_layouts[type].min_size)
+		return journal_invalid(journal, offset, "an object too small for its type");
+
+	if (journal_object_layouts[type].item_size &&
+	    (size - journal_object_layouts[type].min_size) % journal_object_layouts[type].item_size)
+		return journal_invalid(journal, offset, "an object with partial items");
+
+	return 0;
+}
+
+
+/* check the header of journal as loaded, in host order, returns < 0 if it's not usable */
+static int header_check(journal_t *journal, const Header *header)
+{
+	if (memcmp(header->signature, HEADER_SIGNATURE, sizeof(header->signature)))
+		return journal_invalid(journal, 0, "no journal signature");
+
+	if (header->incompatible_flags & ~HEADER_INCOMPATIBLE_ANY)
+		return journal_invalid(journal, 0, "unsupported incompatible flags");
+
+	if (header->header_size < JOURNAL_HEADER_SIZE_MIN || (header->header_size & 7))
+		return journal_invalid(journal, 0, "an invalid header size");
+
+	/* objects are bounded by the file rather than the arena, as reclaiming tail-waste shrinks the former */
+	if (header->tail_object_offset &&
+	    (header->tail_object_offset < header->header_size || !object_extent_valid(journal, header->tail_object_offset, sizeof(ObjectHeader))))
+		return journal_invalid(journal, 0, "an invalid tail object offset");
+
+	if (header->data_hash_table_size &&
+	    (!object_extent_valid(journal, header->data_hash_table_offset, header->data_hash_table_size) || header->data_hash_table_size % sizeof(HashItem)))
+		return journal_invalid(journal, 0, "an invalid data hash table");
+
+	if (header->field_hash_table_size &&
+	    (!object_extent_valid(journal, header->field_hash_table_offset, header->field_hash_table_size) || header->field_hash_table_size % sizeof(HashItem)))
+		return journal_invalid(journal, 0, "an invalid field hash table");
+
+	return 0;
+}
+
+
+/* An object header was loaded while iterating, skip it when invalid but
+ * plausibly sized, otherwise there's no telling where the next object is
+ * and the remainder of the journal gets skipped.
+ *
+ * When pooled this is the journal's iter_steps[slot], which survives its
+ * dispatch for reuse by a later step, unless erroring where it's freed
+ * regardless.  It stays busy until returning, as the closure continuing the
+ * iteration may well have the next step dispatched before then, which has
+ * to use the other slot.
+ */
+THUNK_DEFINE_STATIC(got_iter_object_header, iou_t *, iou, journal_t **, journal, Header *, header, uint64_t *, iter_offset, ObjectHeader *, iter_object_header, thunk_t *, closure, int, slot)
+{
+	_journal_t	*_journal;
+	int		r;
+
+	assert(iou);
+	assert(journal);
+	assert(iter_offset);
+	assert(iter_object_header);
+	assert(closure);
+
+	_journal = container_of(*journal, _journal_t, public);
+
+	iter_object_header->size = le64toh(iter_object_header->size);
+
+	if (object_check(*journal, *iter_offset, iter_object_header->type, iter_object_header->size) < 0) {
+		if (!object_extent_valid(*journal, *iter_offset, iter_object_header->size))
+			iter_object_header->size = 0;
+
+		r = journal_iter_next_object(iou, journal, header, iter_offset, iter_object_header, closure);
+	} else {
+		journal_readahead_skip(_journal, *iter_offset, iter_object_header->size);
+		r = thunk_dispatch(closure);
+	}
+
+	if (slot < 0)
+		return thunk_end(r);
+
+	_journal->iter_steps_busy &= ~(1u << slot);
+	if (r < 0)
+		_journal->iter_steps[slot] = NULL;
+
+	return thunk_mid(r);
+}
+
+
+/* Queues IO on iou for getting the next object from (*journal)->fd
+ * addressed by state in {iter_offset,iter_object_header} storing it @
  * *iter_object_header which must already have space allocated to accomodate
  * sizeof(ObjectHeader), registering closure for dispatch when completed.  This
  * only performs a single step, advancing the offset in *iter_offset by
@@ -445,86 +2911,498 @@ THUNK_DEFINE_STATIC(got_iter_object_header, iou_t *, iou, journal_t *, journal,
  * *iter_object_header, and do whatever is appropriate upon reaching the end of
  * the journal.  If journal_iter_next_object() recurs after reaching this
  * point, it will restart iterating from the first object of the journal.
+ *
+ * With journals_config.readahead set, a window of reads is kept in flight
+ * ahead of *iter_offset so a sequential scan isn't serialized on a single
+ * small read per object.  The window is released upon reaching the end.
+ * Mapped journals get madvise() hints for the same purpose.
+ *
+ * With journals_config.cache_neutral set, journals which couldn't be opened
+ * O_DIRECT have the page cache dropped behind *iter_offset as it advances.
+ *
+ * No allocations are made per object in the steady state, the journal keeps
+ * a pair of step closures it reinitializes each time, one for the step being
+ * dispatched and one for the step it continues with, only falling back to
+ * allocating one when other iterations of the journal have both in use.
+ * Closures passed in should likewise be reusable, see journal_iter_objects().
+ */
+THUNK_DEFINE(journal_iter_next_object, iou_t *, iou, journal_t **, journal, Header *, header, uint64_t *, iter_offset, ObjectHeader *, iter_object_header, thunk_t *, closure)
+{
+	_journal_t	*_journal;
+	int		slot, r;
+
+	assert(iou);
+	assert(journal);
+	assert(iter_offset);
+	assert(iter_object_header);
+	assert(closure);
+
+	_journal = container_of(*journal, _journal_t, public);
+
+	/* restart iterating when entered with (*iter_offset == 0) */
+	if (!(*iter_offset)) {
+		*iter_offset = header->header_size;
+
+		if (_journal->map) {
+			(void) madvise(_journal->map, _journal->map_size, MADV_SEQUENTIAL);
+			_journal->map_willneed = 0;
+		}
+		_journal->dontneed = 0;
+	} else {
+		/* a zero size is left by got_iter_object_header() when there's no next object to be found */
+		if (iter_object_header->size)
+			*iter_offset += ALIGN64(iter_object_header->size);
+		else
+			*iter_offset = header->tail_object_offset + 1;
+
+		r = journal_dontneed(iou, _journal, header, *iter_offset, 0);
+		if (r < 0)
+			return r;
+	}
+
+	/* final dispatch if past tail object */
+	if (*iter_offset > header->tail_object_offset) {
+		journal_readahead_release(_journal);
+
+		r = journal_dontneed(iou, _journal, header, header->header_size + header->arena_size, 1);
+		if (r < 0)
+			return r;
+
+		*iter_offset = 0;
+		return thunk_dispatch(closure);
+	}
+
+	/* the window only needs to reach the tail object's header, anything
+	 * beyond it is left to the regular journal_read() path.
+	 */
+	r = journal_readahead(iou, _journal, *iter_offset, header->tail_object_offset + sizeof(ObjectHeader));
+	if (r < 0)
+		return r;
+
+	for (slot = 0; slot < 2; slot++) {
+		if (!(_journal->iter_steps_busy & (1u << slot)))
+			break;
+	}
+
+	if (slot == 2)
+		return	journal_read(iou, *journal, *iter_offset, sizeof(ObjectHeader), iter_object_header, THUNK(
+				got_iter_object_header(iou, journal, header, iter_offset, iter_object_header, closure, -1)));
+
+	if (!_journal->iter_steps[slot]) {
+		_journal->iter_steps[slot] = THUNK(got_iter_object_header(iou, journal, header, iter_offset, iter_object_header, closure, slot));
+		if (!_journal->iter_steps[slot])
+			return -ENOMEM;
+	} else {
+		THUNK_INIT(got_iter_object_header(_journal->iter_steps[slot], iou, journal, header, iter_offset, iter_object_header, closure, slot));
+	}
+	_journal->iter_steps_busy |= 1u << slot;
+
+	r = journal_read(iou, *journal, *iter_offset, sizeof(ObjectHeader), iter_object_header, _journal->iter_steps[slot]);
+	if (r < 0 && _journal->iter_steps[slot])
+		_journal->iter_steps_busy &= ~(1u << slot);
+
+	return r;
+}
+
+
+/* Helper for the journal_iter_objects() simple objects iteration, it's
+ * its own continuation so the whole iteration shares a single closure.
+ */
+THUNK_DEFINE_STATIC(journal_iter_objects_dispatch, thunk_t *, self, iou_t *, iou, journal_t **, journal, Header *, header, uint64_t *, iter_offset, ObjectHeader *, iter_object_header, thunk_t *, closure)
+{
+	int	r;
+
+	r = thunk_dispatch(closure);
+	if (r < 0)
+		return r;
+
+	if (!(*iter_offset))
+		return 0;
+
+	return thunk_mid(journal_iter_next_object(iou, journal, header, iter_offset, iter_object_header, self));
+}
+
+
+/* Convenience journal object iterator, dispatches thunk for every object in the journal.
+ *
+ * Note in this wrapper there's no way to control/defer the iterator, your
+ * closure is simply dispatched in a loop, no continuation is passed to it for
+ * resuming iteration, which tends to limit its use to simple situations.
+ */
+THUNK_DEFINE(journal_iter_objects, iou_t *, iou, journal_t **, journal, Header *, header, uint64_t *, iter_offset, ObjectHeader *, iter_object_header, thunk_t *, closure)
+{
+	thunk_t	*self;
+	void	*unused;
+
+	assert(iter_offset);
+
+	*iter_offset = 0;
+
+	self = THUNK_ALLOC(journal_iter_objects_dispatch, &unused, 0);
+	if (!self)
+		return -ENOMEM;
+
+	return	journal_iter_next_object(iou, journal, header, iter_offset, iter_object_header, THUNK_INIT(
+			journal_iter_objects_dispatch(self, self, iou, journal, header, iter_offset, iter_object_header, closure)));
+}
+
+
+/* Borrow the region of the journal the next batch is parsed from, or finish
+ * the iteration when past the end of its range.  Returns 1 when finished,
+ * having dispatched closure with an empty batch.
+ */
+static int object_batch_next(iou_t *iou, _journal_t *_journal, Header *header, journal_object_batch_t *batch, thunk_t *step, thunk_t *closure)
+{
+	journal_ra_chunk_t	*chunk;
+	uint64_t		limit, length;
+	int			r;
+
+	if (batch->offset >= batch->end) {
+		if (batch->whole) {
+			journal_readahead_release(_journal);
+
+			r = journal_dontneed(iou, _journal, header, header->header_size + header->arena_size, 1);
+			if (r < 0)
+				return r;
+		}
+
+		batch->n_objects = 0;
+		r = thunk_dispatch(closure);
+		if (r < 0)
+			return r;
+
+		return 1;
+	}
+
+	/* the header of the last object in range is all that's needed beyond it */
+	limit = batch->end - 1 + sizeof(ObjectHeader);
+	length = limit - batch->offset;
+	if (length > JOURNAL_BATCH_SIZE)
+		length = JOURNAL_BATCH_SIZE;
+
+	/* ranges of a journal scanned concurrently would only fight over its
+	 * readahead window and page cache dropping, those are left to whole
+	 * journal scans.
+	 */
+	if (batch->whole) {
+		r = journal_dontneed(iou, _journal, header, batch->offset, 0);
+		if (r < 0)
+			return r;
+
+		r = journal_readahead(iou, _journal, batch->offset, limit);
+		if (r < 0)
+			return r;
+
+		/* stop at the end of the readahead chunk the region starts in, so it's
+		 * borrowed straight from the window instead of read again alongside it.
+		 */
+		chunk = ra_find(_journal, batch->offset, sizeof(ObjectHeader));
+		if (chunk && chunk->offset + chunk->length - batch->offset < length)
+			length = chunk->offset + chunk->length - batch->offset;
+	}
+
+	return thunk_end(journal_borrow(iou, &_journal->public, batch->offset, length, &batch->view, step));
+}
+
+
+/* Parse every object header in the borrowed region into the batch, deliver
+ * it, and continue with the next region.  Invalid objects are skipped as in
+ * got_iter_object_header().
+ */
+THUNK_DEFINE_STATIC(got_object_batch, thunk_t *, self, iou_t *, iou, journal_t **, journal, Header *, header, journal_object_batch_t *, batch, thunk_t *, closure)
+{
+	_journal_t	*_journal;
+	uint64_t	end;
+	int		r;
+
+	assert(batch);
+	assert(batch->view.data);
+
+	_journal = container_of(*journal, _journal_t, public);
+	end = batch->view.offset + batch->view.length;
+	batch->n_objects = 0;
+
+	while (batch->offset + sizeof(ObjectHeader) <= end &&
+	       batch->offset < batch->end &&
+	       batch->n_objects < JOURNAL_BATCH_OBJECTS) {
+		const ObjectHeader	*o = batch->view.data + (batch->offset - batch->view.offset);
+		uint64_t		size = le64toh(o->size);
+
+		if (object_check(*journal, batch->offset, o->type, size) < 0) {
+			if (!object_extent_valid(*journal, batch->offset, size)) {
+				batch->offset = batch->end;
+				break;
+			}
+		} else {
+			journal_object_ref_t	*ref = &batch->objects[batch->n_objects++];
+
+			ref->offset = batch->offset;
+			ref->size = size;
+			ref->type = o->type;
+			ref->flags = o->flags;
+
+			if (batch->whole)
+				journal_readahead_skip(_journal, batch->offset, size);
+		}
+
+		batch->offset += ALIGN64(size);
+	}
+
+	journal_view_release(&batch->view);
+
+	if (batch->n_objects) {
+		r = thunk_dispatch(closure);
+		if (r < 0)
+			return r;
+	}
+
+	r = object_batch_next(iou, _journal, header, batch, self, closure);
+	if (r < 0)
+		return r;
+
+	/* finished, this closure is done too */
+	if (r > 0)
+		return 0;
+
+	return 1;
+}
+
+
+/* start a batched iteration of the objects starting within [start, end) */
+static int object_batches_start(iou_t *iou, journal_t **journal, Header *header, uint64_t start, uint64_t end, int whole, journal_object_batch_t *batch, thunk_t *closure)
+{
+	thunk_t	*self;
+	void	*unused;
+	int	r;
+
+	batch->offset = start;
+	batch->end = end;
+	batch->whole = whole;
+	batch->n_objects = 0;
+
+	self = THUNK_ALLOC(got_object_batch, &unused, 0);
+	if (!self)
+		return -ENOMEM;
+
+	THUNK_INIT(got_object_batch(self, self, iou, journal, header, batch, closure));
+
+	r = object_batch_next(iou, container_of(*journal, _journal_t, public), header, batch, self, closure);
+	if (r > 0)
+		thunk_free(self);
+
+	return thunk_end(r);
+}
+
+
+/* Batched journal object iterator, closure is dispatched with up to
+ * JOURNAL_BATCH_OBJECTS objects at a time in batch->objects[], parsed from
+ * JOURNAL_BATCH_SIZE regions of the journal borrowed in one go rather than
+ * loading each object header on its own.  The objects are in journal order,
+ * and closure must remain dispatchable until it's dispatched once more with
+ * an empty batch at the end of the journal.
+ *
+ * Only the object headers are described, the batch has no access to the
+ * objects themselves, and is reused for the next batch once closure returns.
  */
-THUNK_DEFINE(journal_iter_next_object, iou_t *, iou, journal_t **, journal, Header *, header, uint64_t *, iter_offset, ObjectHeader *, iter_object_header, thunk_t *, closure)
+THUNK_DEFINE(journal_iter_object_batches, iou_t *, iou, journal_t **, journal, Header *, header, journal_object_batch_t *, batch, thunk_t *, closure)
 {
+	_journal_t	*_journal;
+
 	assert(iou);
 	assert(journal);
-	assert(iter_offset);
-	assert(iter_object_header);
+	assert(header);
+	assert(batch);
 	assert(closure);
 
-	/* restart iterating when entered with (*iter_offset == 0) */
-	if (!(*iter_offset))
-		*iter_offset = header->header_size;
-	else {
-		if (iter_object_header->size)
-			*iter_offset += ALIGN64(iter_object_header->size);
-		else {
-			fprintf(stderr, "Encountered zero-sized object, journal \"%s\" appears corrupt, ignoring remainder\n", (*journal)->name);
-			*iter_offset = header->tail_object_offset + 1;
-		}
-	}
+	_journal = container_of(*journal, _journal_t, public);
 
-	/* final dispatch if past tail object */
-	if (*iter_offset > header->tail_object_offset) {
-		*iter_offset = 0;
-		return thunk_dispatch(closure);
+	if (_journal->map) {
+		(void) madvise(_journal->map, _journal->map_size, MADV_SEQUENTIAL);
+		_journal->map_willneed = 0;
 	}
+	_journal->dontneed = 0;
 
-	return	journal_read(iou, *journal, *iter_offset, sizeof(ObjectHeader), iter_object_header, THUNK(
-			got_iter_object_header(iou, *journal, iter_offset, iter_object_header, closure)));
+	return object_batches_start(iou, journal, header, header->header_size, header->tail_object_offset + 1, 1, batch, closure);
 }
 
 
-/* Helper for the journal_iter_objects() simple objects iteration. */
-THUNK_DEFINE_STATIC(journal_iter_objects_dispatch, iou_t *, iou, journal_t **, journal, Header *, header, uint64_t *, iter_offset, ObjectHeader *, iter_object_header, thunk_t *, closure)
+/* Like journal_iter_object_batches(), but only for the objects starting
+ * within [start, end), where start must be the offset of an object, as
+ * found by journal_get_split_points().  Several ranges of a journal may be
+ * iterated at once, each with its own batch, though without readahead.
+ */
+THUNK_DEFINE(journal_iter_object_range, iou_t *, iou, journal_t **, journal, Header *, header, uint64_t, start, uint64_t, end, journal_object_batch_t *, batch, thunk_t *, closure)
 {
-	int	r;
-
-	r = thunk_dispatch(closure);
-	if (r < 0)
-		return r;
+	assert(iou);
+	assert(journal);
+	assert(header);
+	assert(batch);
+	assert(closure);
 
-	if (!(*iter_offset))
-		return 0;
+	if (end > header->tail_object_offset + 1)
+		end = header->tail_object_offset + 1;
 
-	return	thunk_end(journal_iter_next_object(iou, journal, header, iter_offset, iter_object_header, THUNK(
-			journal_iter_objects_dispatch(iou, journal, header, iter_offset, iter_object_header, closure))));
+	return object_batches_start(iou, journal, header, start, end, 0, batch, closure);
 }
 
 
-/* Convenience journal object iterator, dispatches thunk for every object in the journal.
- *
- * Note in this wrapper there's no way to control/defer the iterator, your
- * closure is simply dispatched in a loop, no continuation is passed to it for
- * resuming iteration, which tends to limit its use to simple situations.
+/* Object offsets gathered by journal_get_split_points(), the entry arrays
+ * are chained from the header through the whole journal, giving known
+ * object starts spread throughout it without scanning anything.
  */
-THUNK_DEFINE(journal_iter_objects, iou_t *, iou, journal_t **, journal, Header *, header, uint64_t *, iter_offset, ObjectHeader *, iter_object_header, thunk_t *, closure)
+typedef struct split_walk_t {
+	iou_t		*iou;
+	journal_t	**journal;
+	Header		*header;
+	uint64_t	*points;
+	unsigned	*n_ranges;
+	thunk_t		*closure;
+	uint8_t		entry_array[offsetof(EntryArrayObject, items)];
+	unsigned	n_candidates;
+	uint64_t	candidates[JOURNAL_SPLIT_CANDIDATES];
+} split_walk_t;
+
+
+static void split_walk_add(split_walk_t *walk, uint64_t offset)
 {
-	assert(iter_offset);
+	if (offset <= walk->header->header_size || offset > walk->header->tail_object_offset)
+		return;
 
-	*iter_offset = 0;
+	if (walk->n_candidates < JOURNAL_SPLIT_CANDIDATES)
+		walk->candidates[walk->n_candidates++] = offset;
+}
+
+
+static int split_walk_cmp(const void *a, const void *b)
+{
+	uint64_t	x = *(const uint64_t *)a, y = *(const uint64_t *)b;
 
-	return	journal_iter_next_object(iou, journal, header, iter_offset, iter_object_header, THUNK(
-			journal_iter_objects_dispatch(iou, journal, header, iter_offset, iter_object_header, closure)));
+	return x < y ? -1 : x > y;
 }
 
 
-THUNK_DEFINE_STATIC(got_hash_table_iter_object_header, iou_t *, iou, journal_t *, journal, HashItem *, hash_table, uint64_t, nbuckets, uint64_t *, iter_bucket, uint64_t *, iter_offset, HashedObjectHeader *, iter_object_header, size_t, iter_object_size, thunk_t *, closure)
+/* pick the split points from the candidates, spread as evenly as they allow */
+static int split_walk_finish(split_walk_t *walk)
+{
+	Header		*header = walk->header;
+	uint64_t	*points = walk->points;
+	uint64_t	end, span;
+	unsigned	n = 0, n_max = *walk->n_ranges;
+	thunk_t		*closure = walk->closure;
+
+	end = header->tail_object_offset + 1;
+
+	if (header->tail_object_offset >= header->header_size) {
+		span = (end - header->header_size) / n_max;
+		if (span < JOURNAL_SPLIT_MIN_SIZE)
+			span = JOURNAL_SPLIT_MIN_SIZE;
+
+		qsort(walk->candidates, walk->n_candidates, sizeof(uint64_t), split_walk_cmp);
+
+		points[n++] = header->header_size;
+		for (unsigned i = 0; i < walk->n_candidates && n < n_max; i++) {
+			if (walk->candidates[i] - points[n - 1] >= span &&
+			    end - walk->candidates[i] >= span / 2)
+				points[n++] = walk->candidates[i];
+		}
+	}
+
+	points[n] = end;
+	*walk->n_ranges = n;
+	free(walk);
+
+	return thunk_dispatch(closure);
+}
+
+
+THUNK_DEFINE_STATIC(split_walk_got_entry_array, split_walk_t *, walk, uint64_t, offset)
+{
+	const EntryArrayObject	*ea = (const EntryArrayObject *)walk->entry_array;
+	uint64_t		next;
+
+	if (object_check(*walk->journal, offset, ea->object.type, le64toh(ea->object.size)) < 0 ||
+	    ea->object.type != OBJECT_ENTRY_ARRAY)
+		return thunk_end(split_walk_finish(walk));
+
+	next = le64toh(ea->next_entry_array_offset);
+	if (next <= offset || next > walk->header->tail_object_offset || walk->n_candidates >= JOURNAL_SPLIT_CANDIDATES)
+		return thunk_end(split_walk_finish(walk));
+
+	split_walk_add(walk, next);
+
+	return	thunk_end(journal_read(walk->iou, *walk->journal, next, sizeof(walk->entry_array), walk->entry_array, THUNK(
+			split_walk_got_entry_array(walk, next))));
+}
+
+
+/* Find up to *n_ranges offsets in journal known to be object starts without
+ * scanning it, splitting its objects into ranges of comparable size for
+ * journal_iter_object_range() to iterate concurrently.  Range i is
+ * [points[i], points[i + 1]), points must have room for *n_ranges + 1
+ * offsets, and *n_ranges is updated to how many ranges were found, which
+ * is 1 for journals too small to be worth splitting, and 0 for empty ones.
+ *
+ * The split points come from the objects the header refers to, and the
+ * chain of entry arrays following from its entry_array_offset.
+ */
+THUNK_DEFINE(journal_get_split_points, iou_t *, iou, journal_t **, journal, Header *, header, uint64_t *, points, unsigned *, n_ranges, thunk_t *, closure)
 {
+	split_walk_t	*walk;
+
 	assert(iou);
 	assert(journal);
-	assert(hash_table);
-	assert(iter_bucket && *iter_bucket < nbuckets);
-	assert(iter_offset);
-	assert(iter_object_header);
+	assert(header);
+	assert(points);
+	assert(n_ranges && *n_ranges);
 	assert(closure);
 
+	walk = malloc(sizeof(*walk));
+	if (!walk)
+		return -ENOMEM;
+
+	walk->iou = iou;
+	walk->journal = journal;
+	walk->header = header;
+	walk->points = points;
+	walk->n_ranges = n_ranges;
+	walk->closure = closure;
+	walk->n_candidates = 0;
+
+	if (header->data_hash_table_size)
+		split_walk_add(walk, header->data_hash_table_offset - sizeof(ObjectHeader));
+	if (header->field_hash_table_size)
+		split_walk_add(walk, header->field_hash_table_offset - sizeof(ObjectHeader));
+	split_walk_add(walk, header->tail_object_offset);
+
+	if (*n_ranges == 1 ||
+	    !header->entry_array_offset ||
+	    header->entry_array_offset <= header->header_size ||
+	    header->entry_array_offset > header->tail_object_offset)
+		return split_walk_finish(walk);
+
+	split_walk_add(walk, header->entry_array_offset);
+
+	return	journal_read(iou, *journal, header->entry_array_offset, sizeof(walk->entry_array), walk->entry_array, THUNK(
+			split_walk_got_entry_array(walk, header->entry_array_offset)));
+}
+
+
+/* normalize and check a hashed object as loaded from a hash chain @ offset, returns < 0 if it's not usable */
+static int hashed_object_to_host(journal_t *journal, uint64_t offset, HashedObjectHeader *iter_object_header, size_t iter_object_size)
+{
+	int	r;
+
 	iter_object_header->object.size = le64toh(iter_object_header->object.size);
 	iter_object_header->hash = le64toh(iter_object_header->hash);
 	iter_object_header->next_hash_offset = le64toh(iter_object_header->next_hash_offset);
 
+	if (iter_object_header->object.type != OBJECT_DATA && iter_object_header->object.type != OBJECT_FIELD)
+		return journal_invalid(journal, offset, "a hash chain through a non-hashed object");
+
+	r = object_check(journal, offset, iter_object_header->object.type, iter_object_header->object.size);
+	if (r < 0)
+		return r;
+
 	if (iter_object_size > sizeof(HashedObjectHeader)) {
 		/* The caller can iterate either the field or data hash tables,
 		 * so just introspect and handle those two... using a size >
@@ -548,115 +3426,366 @@ THUNK_DEFINE_STATIC(got_hash_table_iter_object_header, iou_t *, iou, journal_t *
 		case OBJECT_FIELD: {
 			FieldObject	*field_object = (FieldObject *)iter_object_header;
 
-			assert(iter_object_size >= sizeof(FieldObject));
+			assert(iter_object_size >= sizeof(FieldObject));
+
+			field_object->head_data_offset = le64toh(field_object->head_data_offset);
+			break;
+		}
+		}
+	}
+
+	return 0;
+}
+
+
+THUNK_DEFINE_STATIC(got_hash_table_iter_object_header, iou_t *, iou, journal_t *, journal, HashItem *, hash_table, uint64_t, nbuckets, uint64_t *, iter_bucket, uint64_t *, iter_offset, HashedObjectHeader *, iter_object_header, size_t, iter_object_size, thunk_t *, closure)
+{
+	int	r;
+
+	assert(iou);
+	assert(journal);
+	assert(hash_table);
+	assert(iter_bucket && *iter_bucket < nbuckets);
+	assert(iter_offset);
+	assert(iter_object_header);
+	assert(closure);
+
+	r = hashed_object_to_host(journal, *iter_offset, iter_object_header, iter_object_size);
+	if (r < 0) {
+		thunk_free(closure);
+		return r;
+	}
+
+	return thunk_end(thunk_dispatch(closure));
+}
+
+
+/* Queues IO on iou for getting the next object from hash_table{_size}
+ * positioned by state {iter_bucket,iter_offset,iter_object_header} storing it
+ * @ *iter_object_header which must already have space allocated to accomodate
+ * iter_object_size, registering closure for dispatch when completed.  This
+ * only performs a single step, advancing the state in
+ * {iter_bucket,iter_offset} appropriate for continuing via another call.
+ *
+ * When (*iter_offset == 0) it's considered the initial iteration, as this is
+ * an invalid object offset (0=the journal header), and the first object of the
+ * table will be loaded into *iter_object_header without advancing anything.
+ *
+ * When closure gets dispatched with (*iter_offset == 0), there's no more
+ * objects in hash_table, and *iter_object_header will have been unmodified.
+ * Hence closure should always check if (*iter_offset == 0) before using
+ * *iter_object_header, and do whatever is appropriate upon reaching the end of
+ * the hash table.  If journal_hash_table_iter_next_object() recurs after
+ * reaching this point, it will restart iterating from the first object of the
+ * table.
+ */
+THUNK_DEFINE(journal_hash_table_iter_next_object, iou_t *, iou, journal_t **, journal, HashItem **, hash_table, uint64_t *, hash_table_size, uint64_t *, iter_bucket, uint64_t *, iter_offset, HashedObjectHeader *, iter_object_header, size_t, iter_object_size, thunk_t *, closure)
+{
+	size_t		nbuckets;
+
+	assert(iou);
+	assert(journal);
+	assert(hash_table);
+	assert(hash_table_size && *hash_table_size >= sizeof(HashItem));
+	assert(iter_bucket);
+	assert(iter_offset);
+	assert(iter_object_header);
+	assert(iter_object_size >= sizeof(HashedObjectHeader));
+	assert(closure);
+
+	nbuckets = *hash_table_size / sizeof(HashItem);
+
+	assert(*iter_bucket < nbuckets);
+
+	/* restart iterating when entered with (*iter_offset == 0) */
+	if (!*iter_offset)
+		*iter_bucket = 0;
+
+	if (*iter_offset && *iter_offset != (*hash_table)[*iter_bucket].tail_hash_offset) {
+		*iter_offset = iter_object_header->next_hash_offset;
+	} else {
+		do {
+			(*iter_bucket)++;
+			if (*iter_bucket >= nbuckets) {
+				*iter_offset = 0;
+				return thunk_end(thunk_dispatch(closure));
+			}
+			(*iter_offset) = (*hash_table)[*iter_bucket].head_hash_offset;
+		} while (!(*iter_offset));
+	}
+
+	return	journal_read(iou, *journal, *iter_offset, iter_object_size, iter_object_header, THUNK(
+			got_hash_table_iter_object_header(iou, *journal, *hash_table, *hash_table_size, iter_bucket, iter_offset, iter_object_header, iter_object_size, closure)));
+}
+
+
+/* Helper for the journal_hash_table_for_each() simple hash table iteration. */
+THUNK_DEFINE_STATIC(journal_hash_table_for_each_dispatch, iou_t *, iou, journal_t **, journal, HashItem **, hash_table, uint64_t *, hash_table_size, uint64_t *, iter_bucket, uint64_t *, iter_offset, HashedObjectHeader *, iter_object_header, size_t, iter_object_size, thunk_t *, closure)
+{
+	int	r;
+
+	r = thunk_dispatch(closure);
+	if (r < 0)
+		return r;
+
+	if (!*iter_offset)
+		return 0;
+
+	return	thunk_end(journal_hash_table_iter_next_object(iou, journal, hash_table, hash_table_size, iter_bucket, iter_offset, iter_object_header, iter_object_size, THUNK(
+			journal_hash_table_for_each_dispatch(iou, journal, hash_table, hash_table_size, iter_bucket, iter_offset, iter_object_header, iter_object_size, closure))));
+}
+
+
+/* Convenience hash table iterator, dispatches thunk for every object in the hash table.
+ * iter_object_size would typically be sizeof(DataObject) or sizeof(FieldObject), as
+ * these are the two hash table types currently handled.  The size is supplied rather
+ * than a type, because one may iterate by only loading the HashedObjectHeader portion.
+ * The size is introspected to determine if more than just the HashedObjectHeader is being
+ * loaded, and its type asserted to fit in the supplied space.
+ *
+ * Note in this wrapper there's no way to control/defer the iterator, your
+ * closure is simply dispatched in a loop, no continuation is passed to it for
+ * resuming iteration, which tends to limit its use to simple situations.
+ */
+THUNK_DEFINE(journal_hash_table_for_each, iou_t *, iou, journal_t **, journal, HashItem **, hash_table, uint64_t *, hash_table_size, uint64_t *, iter_bucket, uint64_t *, iter_offset, HashedObjectHeader *, iter_object_header, size_t, iter_object_size, thunk_t *, closure)
+{
+	assert(iter_offset);
+
+	*iter_offset = 0;
+
+	return	journal_hash_table_iter_next_object(iou, journal, hash_table, hash_table_size, iter_bucket, iter_offset, iter_object_header, iter_object_size, THUNK(
+			journal_hash_table_for_each_dispatch(iou, journal, hash_table, hash_table_size, iter_bucket, iter_offset, iter_object_header, iter_object_size, closure)));
+}
+
+
+/* A chain being walked by journal_hash_table_for_each_parallel() */
+typedef struct hash_chain_t {
+	uint64_t		bucket, offset;
+	HashedObjectHeader	*object;	/* iter_object_size bytes */
+} hash_chain_t;
+
+typedef struct hash_walk_t {
+	iou_t			*iou;
+	journal_t		**journal;
+	HashItem		*table;
+	uint64_t		nbuckets, next_bucket;
+	size_t			object_size;
+	unsigned		n_active;	/* chains with an object being loaded */
+	int			r;		/* first error, the walk drains and finishes with it */
+	uint64_t		*iter_bucket, *iter_offset;
+	HashedObjectHeader	**iter_object;
+	thunk_t			*closure;	/* NULL once it's ended itself, see hash_walk_deliver() */
+	hash_chain_t		chains[];
+} hash_walk_t;
+
+
+static int hash_walk_advance(hash_walk_t *walk, hash_chain_t *chain);
+
+
+/* the walk is done, give the closure its final dispatch unless it's already ended */
+static int hash_walk_finish(hash_walk_t *walk)
+{
+	thunk_t	*closure = walk->closure;
+	int	err = walk->r, r;
+
+	*walk->iter_object = NULL;
+	free(walk);
+
+	if (!closure)
+		return err;
+
+	r = thunk_dispatch(closure);
+	if (r > 0) {
+		thunk_free(closure);
+		r = 0;
+	}
+
+	return err < 0 ? err : r;
+}
+
+
+/* Stop handing out buckets after an error, the chains still in flight are
+ * left to land undelivered, and the last of them finishes the walk with r.
+ */
+static int hash_walk_fail(hash_walk_t *walk, int r)
+{
+	if (!walk->r)
+		walk->r = r;
+
+	walk->next_bucket = walk->nbuckets;
+	if (walk->n_active)
+		return 0;
+
+	return hash_walk_finish(walk);
+}
+
+
+/* a chain's object is in, hand it to the closure then move the chain along */
+THUNK_DEFINE_STATIC(hash_walk_deliver, hash_walk_t *, walk, hash_chain_t *, chain)
+{
+	int	r;
+
+	assert(walk);
+	assert(chain);
+
+	walk->n_active--;
+
+	if (walk->r || !walk->closure)
+		return hash_walk_fail(walk, walk->r);
+
+	r = hashed_object_to_host(*walk->journal, chain->offset, chain->object, walk->object_size);
+	if (r < 0)
+		return hash_walk_fail(walk, r);
+
+	*walk->iter_bucket = chain->bucket;
+	*walk->iter_offset = chain->offset;
+	*walk->iter_object = chain->object;
+	r = thunk_dispatch(walk->closure);
+	if (r <= 0) {
+		/* the closure ended itself and has been freed by its dispatch */
+		walk->closure = NULL;
+
+		return hash_walk_fail(walk, r);
+	}
+
+	return hash_walk_advance(walk, chain);
+}
+
+
+/* Load chain's next object, the next in its bucket, or the head of the next
+ * unclaimed non-empty bucket.  Once there's nothing left for any chain, the
+ * closure gets its final dispatch and the walk is done.
+ */
+static int hash_walk_advance(hash_walk_t *walk, hash_chain_t *chain)
+{
+	int	r;
+
+	if (chain->offset && chain->offset != walk->table[chain->bucket].tail_hash_offset) {
+		chain->offset = chain->object->next_hash_offset;
+	} else {
+		chain->offset = 0;
+		while (!chain->offset && walk->next_bucket < walk->nbuckets) {
+			chain->bucket = walk->next_bucket++;
+			chain->offset = walk->table[chain->bucket].head_hash_offset;
+		}
+	}
+
+	if (!chain->offset) {
+		if (walk->n_active || walk->next_bucket < walk->nbuckets)
+			return 0;
 
-			field_object->head_data_offset = le64toh(field_object->head_data_offset);
-			break;
-		}
-		default:
-			assert(0);
-		}
+		/* the last chain finished */
+		return hash_walk_finish(walk);
 	}
 
-	return thunk_end(thunk_dispatch(closure));
+	walk->n_active++;
+
+	r = journal_read(walk->iou, *walk->journal, chain->offset, walk->object_size, chain->object, THUNK(
+		hash_walk_deliver(walk, chain)));
+	if (r < 0) {
+		walk->n_active--;
+		chain->offset = 0;
+
+		return hash_walk_fail(walk, r);
+	}
+
+	return 0;
 }
 
 
-/* Queues IO on iou for getting the next object from hash_table{_size}
- * positioned by state {iter_bucket,iter_offset,iter_object_header} storing it
- * @ *iter_object_header which must already have space allocated to accomodate
- * iter_object_size, registering closure for dispatch when completed.  This
- * only performs a single step, advancing the state in
- * {iter_bucket,iter_offset} appropriate for continuing via another call.
- *
- * When (*iter_offset == 0) it's considered the initial iteration, as this is
- * an invalid object offset (0=the journal header), and the first object of the
- * table will be loaded into *iter_object_header without advancing anything.
+/* Hash table iterator keeping the chains of up to n_chains buckets in
+ * flight at once, dispatching closure for every object in the hash table
+ * in whatever order they arrive, with *iter_object pointing at it, and
+ * *iter_bucket and *iter_offset where it was found.  Each chain is still
+ * walked one object at a time, but the buckets are independent, so a full
+ * walk isn't one long chain of dependent reads.  n_chains of 0 uses
+ * JOURNAL_HASH_CHAINS_DEFAULT.
  *
- * When closure gets dispatched with (*iter_offset == 0), there's no more
- * objects in hash_table, and *iter_object_header will have been unmodified.
- * Hence closure should always check if (*iter_offset == 0) before using
- * *iter_object_header, and do whatever is appropriate upon reaching the end of
- * the hash table.  If journal_hash_table_iter_next_object() recurs after
- * reaching this point, it will restart iterating from the first object of the
- * table.
+ * *iter_object is only valid for the duration of the dispatch, as its
+ * space gets reused for the next object of the same chain.  Like
+ * journals_for_each(), closure must expect to be dispatched multiple times,
+ * and must return thunk_mid() for every object to keep the walk going, then
+ * a final time with *iter_object == NULL once there are no more objects,
+ * after which it's freed.  That final dispatch happens on errors too, once
+ * the chains still in flight have landed, an invalid object ends the walk
+ * like any other.  Returning anything else for an object ends the closure
+ * there, so it's not dispatched again, and the walk finishes with what it
+ * returned once the chains in flight have landed.
  */
-THUNK_DEFINE(journal_hash_table_iter_next_object, iou_t *, iou, journal_t **, journal, HashItem **, hash_table, uint64_t *, hash_table_size, uint64_t *, iter_bucket, uint64_t *, iter_offset, HashedObjectHeader *, iter_object_header, size_t, iter_object_size, thunk_t *, closure)
+THUNK_DEFINE(journal_hash_table_for_each_parallel, iou_t *, iou, journal_t **, journal, HashItem **, hash_table, uint64_t *, hash_table_size, unsigned, n_chains, size_t, iter_object_size, uint64_t *, iter_bucket, uint64_t *, iter_offset, HashedObjectHeader **, iter_object, thunk_t *, closure)
 {
-	size_t		nbuckets;
+	hash_walk_t	*walk;
+	uint8_t		*objects;
+	size_t		stride;
 
 	assert(iou);
 	assert(journal);
-	assert(hash_table);
+	assert(hash_table && *hash_table);
 	assert(hash_table_size && *hash_table_size >= sizeof(HashItem));
+	assert(iter_object_size >= sizeof(HashedObjectHeader));
 	assert(iter_bucket);
 	assert(iter_offset);
-	assert(iter_object_header);
-	assert(iter_object_size >= sizeof(HashedObjectHeader));
+	assert(iter_object);
 	assert(closure);
 
-	nbuckets = *hash_table_size / sizeof(HashItem);
-
-	assert(*iter_bucket < nbuckets);
+	if (!n_chains)
+		n_chains = JOURNAL_HASH_CHAINS_DEFAULT;
 
-	/* restart iterating when entered with (*iter_offset == 0) */
-	if (!*iter_offset)
-		*iter_bucket = 0;
+	stride = ALIGN64(iter_object_size);
+	walk = malloc(sizeof(*walk) + (sizeof(hash_chain_t) + stride) * n_chains);
+	if (!walk)
+		return -ENOMEM;
 
-	if (*iter_offset && *iter_offset != (*hash_table)[*iter_bucket].tail_hash_offset) {
-		*iter_offset = iter_object_header->next_hash_offset;
-	} else {
-		do {
-			(*iter_bucket)++;
-			if (*iter_bucket >= nbuckets) {
-				*iter_offset = 0;
-				return thunk_end(thunk_dispatch(closure));
-			}
-			(*iter_offset) = (*hash_table)[*iter_bucket].head_hash_offset;
-		} while (!(*iter_offset));
+	walk->iou = iou;
+	walk->journal = journal;
+	walk->table = *hash_table;
+	walk->nbuckets = *hash_table_size / sizeof(HashItem);
+	walk->next_bucket = 0;
+	walk->object_size = iter_object_size;
+	walk->n_active = 0;
+	walk->r = 0;
+	walk->iter_bucket = iter_bucket;
+	walk->iter_offset = iter_offset;
+	walk->iter_object = iter_object;
+	walk->closure = closure;
+
+	objects = (uint8_t *)&walk->chains[n_chains];
+	for (unsigned i = 0; i < n_chains; i++) {
+		walk->chains[i].offset = 0;
+		walk->chains[i].object = (HashedObjectHeader *)&objects[stride * i];
 	}
 
-	return	journal_read(iou, *journal, *iter_offset, iter_object_size, iter_object_header, THUNK(
-			got_hash_table_iter_object_header(iou, *journal, *hash_table, *hash_table_size, iter_bucket, iter_offset, iter_object_header, iter_object_size, closure)));
-}
-
-
-/* Helper for the journal_hash_table_for_each() simple hash table iteration. */
-THUNK_DEFINE_STATIC(journal_hash_table_for_each_dispatch, iou_t *, iou, journal_t **, journal, HashItem **, hash_table, uint64_t *, hash_table_size, uint64_t *, iter_bucket, uint64_t *, iter_offset, HashedObjectHeader *, iter_object_header, size_t, iter_object_size, thunk_t *, closure)
-{
-	int	r;
+	/* Start all the chains, holding n_active up so the walk can't finish
+	 * while still starting them, even if they all complete synchronously.
+	 */
+	walk->n_active++;
+	for (unsigned i = 0; i < n_chains; i++) {
+		(void) hash_walk_advance(walk, &walk->chains[i]);
 
-	r = thunk_dispatch(closure);
-	if (r < 0)
-		return r;
+		if (walk->r || !walk->chains[i].offset)
+			break;
+	}
+	walk->n_active--;
 
-	if (!*iter_offset)
-		return 0;
+	/* an empty table, everything was satisfied synchronously, or starting failed with nothing in flight */
+	if (!walk->n_active)
+		return hash_walk_finish(walk);
 
-	return	thunk_end(journal_hash_table_iter_next_object(iou, journal, hash_table, hash_table_size, iter_bucket, iter_offset, iter_object_header, iter_object_size, THUNK(
-			journal_hash_table_for_each_dispatch(iou, journal, hash_table, hash_table_size, iter_bucket, iter_offset, iter_object_header, iter_object_size, closure))));
+	return 0;
 }
 
 
-/* Convenience hash table iterator, dispatches thunk for every object in the hash table.
- * iter_object_size would typically be sizeof(DataObject) or sizeof(FieldObject), as
- * these are the two hash table types currently handled.  The size is supplied rather
- * than a type, because one may iterate by only loading the HashedObjectHeader portion.
- * The size is introspected to determine if more than just the HashedObjectHeader is being
- * loaded, and its type asserted to fit in the supplied space.
- *
- * Note in this wrapper there's no way to control/defer the iterator, your
- * closure is simply dispatched in a loop, no continuation is passed to it for
- * resuming iteration, which tends to limit its use to simple situations.
+/* Normalize n little-endian 64-bit words in place, a flat loop the compiler
+ * turns into vector byte swaps on big-endian hosts, and nothing at all on
+ * little-endian ones.
  */
-THUNK_DEFINE(journal_hash_table_for_each, iou_t *, iou, journal_t **, journal, HashItem **, hash_table, uint64_t *, hash_table_size, uint64_t *, iter_bucket, uint64_t *, iter_offset, HashedObjectHeader *, iter_object_header, size_t, iter_object_size, thunk_t *, closure)
+static inline void le64toh_words(uint64_t *words, uint64_t n)
 {
-	assert(iter_offset);
-
-	*iter_offset = 0;
+	if (JOURNAL_HOST_IS_LE)
+		return;
 
-	return	journal_hash_table_iter_next_object(iou, journal, hash_table, hash_table_size, iter_bucket, iter_offset, iter_object_header, iter_object_size, THUNK(
-			journal_hash_table_for_each_dispatch(iou, journal, hash_table, hash_table_size, iter_bucket, iter_offset, iter_object_header, iter_object_size, closure)));
+	for (uint64_t i = 0; i < n; i++)
+		words[i] = le64toh(words[i]);
 }
 
 
@@ -667,11 +3796,9 @@ THUNK_DEFINE_STATIC(got_hashtable, iou_t *, iou, HashItem *, table, uint64_t, si
 	assert(res_hash_table);
 	assert(closure);
 
-	for (uint64_t i = 0; i < size / sizeof(HashItem); i++) {
-		table[i].head_hash_offset = le64toh(table[i].head_hash_offset);
-		table[i].tail_hash_offset = le64toh(table[i].tail_hash_offset);
-	}
-	/* TODO: validation/sanity checks? */
+	/* HashItem is a pair of le64_t offsets */
+	le64toh_words((uint64_t *)table, size / sizeof(HashItem) * 2);
+	/* the chains' offsets are checked as the objects they point at are loaded */
 
 	*res_hash_table = table;
 
@@ -702,14 +3829,190 @@ THUNK_DEFINE(journal_get_hash_table, iou_t *, iou, journal_t **, journal, uint64
 }
 
 
-/* Validate and prepare journal header loaded via journal_get_header @ header, dispatch closure. */
-THUNK_DEFINE_STATIC(got_header, iou_t *, iou, journal_t *, journal, Header *, header, thunk_t *, closure)
+/* A streamed hash table is loaded JOURNAL_HASH_CHUNK_BUCKETS at a time into
+ * one of two chunks, the next chunk being loaded while the chains of the
+ * current one are walked.
+ */
+struct journal_hash_chunks_t {
+	uint64_t	first[2], n[2];		/* buckets held by each chunk */
+	uint8_t		pending[2];
+	unsigned	cur;			/* chunk holding stream->bucket */
+	unsigned	orphaned:1;		/* stream restarted while loading, freed once the loads land */
+	thunk_t		*resume;		/* step waiting on the current chunk to be loaded */
+	HashItem	items[2][JOURNAL_HASH_CHUNK_BUCKETS];
+};
+
+
+THUNK_DEFINE_STATIC(hash_stream_got_chunk, iou_t *, iou, journal_hash_chunks_t *, chunks, unsigned, idx)
+{
+	thunk_t	*resume = chunks->resume;
+
+	assert(iou);
+
+	chunks->pending[idx] = 0;
+
+	if (chunks->orphaned) {
+		if (!chunks->pending[idx ^ 1])
+			free(chunks);
+
+		return 0;
+	}
+
+	le64toh_words((uint64_t *)chunks->items[idx], chunks->n[idx] * 2);
+
+	if (!resume || idx != chunks->cur)
+		return 0;
+
+	chunks->resume = NULL;
+
+	return thunk_end(thunk_dispatch(resume));
+}
+
+
+/* queue loading the chunk of buckets from first into chunk idx, if there are any left */
+static int hash_stream_load(iou_t *iou, journal_t *journal, journal_hash_stream_t *stream, unsigned idx, uint64_t first)
+{
+	journal_hash_chunks_t	*chunks = stream->chunks;
+	uint64_t		nbuckets = stream->table_size / sizeof(HashItem);
+
+	if (first >= nbuckets)
+		return 0;
+
+	chunks->first[idx] = first;
+	chunks->n[idx] = nbuckets - first < JOURNAL_HASH_CHUNK_BUCKETS ? nbuckets - first : JOURNAL_HASH_CHUNK_BUCKETS;
+	chunks->pending[idx] = 1;
+
+	return	journal_read(iou, journal, stream->table_offset + first * sizeof(HashItem), chunks->n[idx] * sizeof(HashItem), chunks->items[idx], THUNK(
+			hash_stream_got_chunk(iou, chunks, idx)));
+}
+
+
+/* Find the first non-empty bucket from stream->bucket, and load the head
+ * of its chain.  When the bucket's chunk is still being loaded, this step
+ * waits for it and gets dispatched again once it's in.
+ */
+THUNK_DEFINE_STATIC(hash_stream_seek, iou_t *, iou, journal_t **, journal, journal_hash_stream_t *, stream, HashedObjectHeader *, iter_object_header, size_t, iter_object_size, thunk_t *, closure)
+{
+	journal_hash_chunks_t	*chunks = stream->chunks;
+	uint64_t		nbuckets = stream->table_size / sizeof(HashItem);
+
+	for (; stream->bucket < nbuckets; stream->bucket++) {
+		unsigned	cur = chunks->cur;
+		HashItem	*item;
+
+		/* moving on to the next chunk, start loading the one after it in the chunk left behind */
+		if (stream->bucket >= chunks->first[cur] + chunks->n[cur]) {
+			int	r;
+
+			cur = chunks->cur ^= 1;
+			r = hash_stream_load(iou, *journal, stream, cur ^ 1, chunks->first[cur] + chunks->n[cur]);
+			if (r < 0)
+				return r;
+		}
+
+		if (chunks->pending[cur]) {
+			chunks->resume = THUNK(hash_stream_seek(iou, journal, stream, iter_object_header, iter_object_size, closure));
+
+			return thunk_end(0);
+		}
+
+		item = &chunks->items[cur][stream->bucket - chunks->first[cur]];
+		if (!item->head_hash_offset)
+			continue;
+
+		stream->offset = item->head_hash_offset;
+
+		return	thunk_end(journal_read(iou, *journal, stream->offset, iter_object_size, iter_object_header, THUNK(
+				got_hash_table_iter_object_header(iou, *journal, chunks->items[cur], nbuckets, &stream->bucket, &stream->offset, iter_object_header, iter_object_size, closure))));
+	}
+
+	/* finished */
+	free(chunks);
+	stream->chunks = NULL;
+	stream->offset = 0;
+
+	return thunk_end(thunk_dispatch(closure));
+}
+
+
+/* Like journal_hash_table_iter_next_object(), but for a hash table streamed
+ * from the journal as it's iterated rather than loaded in its entirety up
+ * front, per the table_offset and table_size of *stream.  The state is all
+ * in *stream, with stream->offset == 0 (re)starting the iteration from the
+ * first bucket, and closure dispatched with stream->offset == 0 once there
+ * are no more objects.
+ *
+ * Only two chunks of JOURNAL_HASH_CHUNK_BUCKETS are held at a time, so the
+ * first objects arrive without waiting on the whole table, and the next
+ * chunk is read while the current one's chains are walked.
+ */
+THUNK_DEFINE(journal_hash_table_stream_next_object, iou_t *, iou, journal_t **, journal, journal_hash_stream_t *, stream, HashedObjectHeader *, iter_object_header, size_t, iter_object_size, thunk_t *, closure)
 {
+	journal_hash_chunks_t	*chunks;
+
 	assert(iou);
 	assert(journal);
-	assert(header);
+	assert(stream);
+	assert(stream->table_size >= sizeof(HashItem));
+	assert(iter_object_header);
+	assert(iter_object_size >= sizeof(HashedObjectHeader));
 	assert(closure);
 
+	if (stream->offset) {
+		chunks = stream->chunks;
+
+		/* continue along the current chain */
+		if (stream->offset != chunks->items[chunks->cur][stream->bucket - chunks->first[chunks->cur]].tail_hash_offset) {
+			stream->offset = iter_object_header->next_hash_offset;
+
+			return	journal_read(iou, *journal, stream->offset, iter_object_size, iter_object_header, THUNK(
+					got_hash_table_iter_object_header(iou, *journal, chunks->items[chunks->cur], stream->table_size / sizeof(HashItem), &stream->bucket, &stream->offset, iter_object_header, iter_object_size, closure)));
+		}
+
+		stream->bucket++;
+
+		return hash_stream_seek(iou, journal, stream, iter_object_header, iter_object_size, closure);
+	}
+
+	/* restart iterating, loading the first two chunks, leaving any still
+	 * being loaded from a previous iteration to be freed once they land
+	 */
+	if (stream->chunks && (stream->chunks->pending[0] || stream->chunks->pending[1])) {
+		stream->chunks->orphaned = 1;
+		if (stream->chunks->resume)
+			thunk_free(stream->chunks->resume);
+		stream->chunks = NULL;
+	}
+
+	if (!stream->chunks) {
+		stream->chunks = malloc(sizeof(*stream->chunks));
+		if (!stream->chunks)
+			return -ENOMEM;
+	}
+
+	chunks = stream->chunks;
+	chunks->cur = 0;
+	chunks->orphaned = 0;
+	chunks->resume = NULL;
+	chunks->n[0] = chunks->n[1] = 0;
+	chunks->pending[0] = chunks->pending[1] = 0;
+	stream->bucket = 0;
+
+	for (unsigned i = 0; i < 2; i++) {
+		int	r;
+
+		r = hash_stream_load(iou, *journal, stream, i, i * JOURNAL_HASH_CHUNK_BUCKETS);
+		if (r < 0)
+			return r;
+	}
+
+	return hash_stream_seek(iou, journal, stream, iter_object_header, iter_object_size, closure);
+}
+
+
+/* normalize header as loaded to host byte order, only needed on big-endian hosts */
+static void header_to_host(Header *header)
+{
 	header->compatible_flags = le32toh(header->compatible_flags);
 	header->incompatible_flags = le32toh(header->incompatible_flags);
 	header->header_size = le64toh(header->header_size);
@@ -733,7 +4036,39 @@ THUNK_DEFINE_STATIC(got_header, iou_t *, iou, journal_t *, journal, Header *, he
 	header->n_entry_arrays = le64toh(header->n_entry_arrays);
 	header->data_hash_chain_depth = le64toh(header->data_hash_chain_depth);
 	header->field_hash_chain_depth = le64toh(header->field_hash_chain_depth);
-	/* TODO: validation/sanity checks? */
+}
+
+
+/* Validate and prepare journal header loaded via journal_get_header @ header, dispatch closure. */
+THUNK_DEFINE_STATIC(got_header, iou_t *, iou, journal_t *, journal, Header *, header, thunk_t *, closure)
+{
+	_journal_t	*_journal;
+	int		r;
+
+	assert(iou);
+	assert(journal);
+	assert(header);
+	assert(closure);
+
+	_journal = container_of(journal, _journal_t, public);
+
+	if (!JOURNAL_HOST_IS_LE)
+		header_to_host(header);
+
+	/* An online journal may have been grown by journald since it was stat'd,
+	 * though only what was mapped at open can be read from a mapped one.
+	 */
+	if (journals_config.backend != JOURNAL_BACKEND_MMAP &&
+	    header->state == STATE_ONLINE &&
+	    header->arena_size <= UINT64_MAX - header->header_size &&
+	    header->header_size + header->arena_size > _journal->bound)
+		_journal->bound = header->header_size + header->arena_size;
+
+	r = header_check(journal, header);
+	if (r < 0) {
+		thunk_free(closure);
+		return r;
+	}
 
 	return thunk_end(thunk_dispatch(closure));
 }
@@ -754,14 +4089,21 @@ THUNK_DEFINE(journal_get_header, iou_t *, iou, journal_t **, journal, Header *,
 
 
 /* Validate and prepare object header loaded via journal_get_object_header @ object_header, dispatch closure. */
-THUNK_DEFINE_STATIC(got_object_header, iou_t *, iou, ObjectHeader *, object_header, thunk_t *, closure)
+THUNK_DEFINE_STATIC(got_object_header, iou_t *, iou, journal_t *, journal, uint64_t, offset, ObjectHeader *, object_header, thunk_t *, closure)
 {
+	int	r;
+
 	assert(iou);
 	assert(object_header);
 	assert(closure);
 
 	object_header->size = le64toh(object_header->size);
-	/* TODO: validation/sanity checks? */
+
+	r = object_check(journal, offset, object_header->type, object_header->size);
+	if (r < 0) {
+		thunk_free(closure);
+		return r;
+	}
 
 	return thunk_end(thunk_dispatch(closure));
 }
@@ -779,22 +4121,17 @@ THUNK_DEFINE(journal_get_object_header, iou_t *, iou, journal_t **, journal, uin
 	assert(closure);
 
 	return	journal_read(iou, *journal, *offset, sizeof(*object_header), object_header, THUNK(
-			got_object_header(iou, object_header, closure)));
+			got_object_header(iou, *journal, *offset, object_header, closure)));
 }
 
 #define OBJECT_N_ITEMS(_o)	\
 	((_o.object.size - offsetof(typeof(_o), items)) / sizeof(*_o.items))
 
-/* Validate and prepare object loaded via journal_get_object @ object, dispatch closure. */
-THUNK_DEFINE_STATIC(got_object, iou_t *, iou, uint64_t, size, Object *, object, thunk_t *, closure)
+/* normalize object as loaded to host byte order, only needed on big-endian hosts */
+static void object_to_host(Object *object)
 {
-	assert(iou);
-	assert(object);
-	assert(closure);
-
 	object->object.size = le64toh(object->object.size);
 
-	/* TODO: validation/sanity checks? */
 	switch (object->object.type) {
 	case OBJECT_DATA:
 		object->data.hashed.hash = le64toh(object->data.hashed.hash);
@@ -817,39 +4154,49 @@ THUNK_DEFINE_STATIC(got_object, iou_t *, iou, uint64_t, size, Object *, object,
 		object->entry.monotonic = le64toh(object->entry.monotonic);
 		//object->entry.boot_id
 		object->entry.xor_hash = le64toh(object->entry.xor_hash);
-		for (uint64_t i = 0, n_items = OBJECT_N_ITEMS(object->entry); i < n_items; i++) {
-			object->entry.items[i].object_offset = le64toh(object->entry.items[i].object_offset);
-			object->entry.items[i].hash = le64toh(object->entry.items[i].hash);
-		}
+		/* EntryItem is a pair of le64_t, object_offset and hash */
+		le64toh_words((uint64_t *)object->entry.items, OBJECT_N_ITEMS(object->entry) * 2);
 		break;
 
 	case OBJECT_DATA_HASH_TABLE:
 	case OBJECT_FIELD_HASH_TABLE:
-		for (uint64_t i = 0, n_items = OBJECT_N_ITEMS(object->hash_table); i < n_items; i++) {
-			object->hash_table.items[i].head_hash_offset = le64toh(object->hash_table.items[i].head_hash_offset);
-			object->hash_table.items[i].tail_hash_offset = le64toh(object->hash_table.items[i].tail_hash_offset);
-		}
+		le64toh_words((uint64_t *)object->hash_table.items, OBJECT_N_ITEMS(object->hash_table) * 2);
 		break;
 
 	case OBJECT_ENTRY_ARRAY:
 		object->entry_array.next_entry_array_offset = le64toh(object->entry_array.next_entry_array_offset);
-		for (uint64_t i = 0, n_items = OBJECT_N_ITEMS(object->entry_array); i < n_items; i++)
-			object->entry_array.items[i] = le64toh(object->entry_array.items[i]);
+		le64toh_words((uint64_t *)object->entry_array.items, OBJECT_N_ITEMS(object->entry_array));
 		break;
 
 	case OBJECT_TAG:
 		object->tag.seqnum = le64toh(object->tag.seqnum);
 		object->tag.epoch = le64toh(object->tag.epoch);
 		break;
+	}
+}
 
-	default:
-		/* XXX: should probably just ignore unknown types instead,
-		 * but the idea here is to let callers safely assume loaded objects
-		 * have been fully validated and byteswapped as needed.
-		 */
-		assert(0);
+
+/* Validate and prepare object loaded via journal_get_object @ object, dispatch closure. */
+THUNK_DEFINE_STATIC(got_object, iou_t *, iou, journal_t *, journal, uint64_t, offset, uint64_t, size, Object *, object, thunk_t *, closure)
+{
+	int	r;
+
+	assert(iou);
+	assert(object);
+	assert(closure);
+
+	/* callers can safely assume loaded objects have been fully validated and byteswapped as needed */
+	r = object_check(journal, offset, object->object.type, le64toh(object->object.size));
+	if (r >= 0 && le64toh(object->object.size) != size)
+		r = journal_invalid(journal, offset, "an object of unexpected size");
+	if (r < 0) {
+		thunk_free(closure);
+		return r;
 	}
 
+	if (!JOURNAL_HOST_IS_LE)
+		object_to_host(object);
+
 	return thunk_end(thunk_dispatch(closure));
 }
 
@@ -877,7 +4224,49 @@ THUNK_DEFINE(journal_get_object, iou_t *, iou, journal_t **, journal, uint64_t *
 	assert(closure);
 
 	return	journal_read(iou, *journal, *offset, *size, *object, THUNK(
-			got_object(iou, *size, *object, closure)));
+			got_object(iou, *journal, *offset, *size, *object, closure)));
+}
+
+
+THUNK_DEFINE_STATIC(borrow_object_got_header, iou_t *, iou, journal_t *, journal, uint64_t, offset, journal_view_t *, view, thunk_t *, closure)
+{
+	uint64_t	size;
+	int		r;
+
+	assert(iou);
+	assert(journal);
+	assert(view);
+	assert(closure);
+
+	size = journal_view_object_size(view);
+	r = object_check(journal, offset, view->object->object.type, size);
+	journal_view_release(view);
+	if (r < 0) {
+		thunk_free(closure);
+		return r;
+	}
+
+	return thunk_end(journal_borrow(iou, journal, offset, size, view, closure));
+}
+
+
+/* Queue IO on iou for borrowing a view of the entire object @ offset *offset from *journal into *view,
+ * registering closure for dispatch once it's available.
+ *
+ * This is the zero-copy counterpart to journal_get_object_full(), no allocation or le64toh()
+ * swapping is performed, view->object is the raw object as found in the journal and must be
+ * released with journal_view_release() when done with it.
+ */
+THUNK_DEFINE(journal_borrow_object, iou_t *, iou, journal_t **, journal, uint64_t *, offset, journal_view_t *, view, thunk_t *, closure)
+{
+	assert(iou);
+	assert(journal);
+	assert(offset);
+	assert(view);
+	assert(closure);
+
+	return	journal_borrow(iou, *journal, *offset, sizeof(ObjectHeader), view, THUNK(
+			borrow_object_got_header(iou, *journal, *offset, view, closure)));
 }
 
 
@@ -886,8 +4275,10 @@ THUNK_DEFINE_STATIC(get_object_full_got_header, iou_t *, iou, journal_t **, jour
 	Object	*o;
 
 	o = malloc(object_header->size);
-	if (!o)
+	if (!o) {
+		thunk_free(closure);
 		return -ENOMEM;
+	}
 
 	*object = o;
 
@@ -908,8 +4299,17 @@ THUNK_DEFINE(journal_get_object_full, iou_t *, iou, journal_t **, journal, uint6
 }
 
 
-/* for every open journal in *journals, store the journal in *journal_iter and dispatch closure */
-/* closure must expect to be dispatched multiple times; once per journal, and will be freed once at end */
+/* For every journal in *journals this job claims, open it, store it in *journal_iter and dispatch closure.
+ * closure must expect to be dispatched multiple times; once per journal, and will be freed once at end.
+ * With multiple jobs each gets its own share of the journals, claimed one
+ * at a time as its window has room, so the faster jobs take more of them.
+ *
+ * The journals are opened through a window of journals_config.window at a
+ * time, a journal is closed once nothing started from closure references it
+ * anymore; no ops in flight for it, and no borrowed views.  So closure
+ * should copy *journal_iter rather than holding on to journal_iter, and not
+ * keep any journal pointers for use after its work on the journal is done.
+ */
 THUNK_DEFINE(journals_for_each, journals_t **, journals, journal_t **, journal_iter, thunk_t *, closure)
 {
 	journals_t	*j;
@@ -919,23 +4319,10 @@ THUNK_DEFINE(journals_for_each, journals_t **, journals, journal_t **, journal_i
 	assert(closure);
 
 	j = *journals;
+	j->journal_iter = journal_iter;
+	j->closure = closure;
 
-	for (size_t i = 0; i < j->n_journals; i++) {
-		int	r;
-
-		if (j->journals[i].public.fd < 0)
-			continue;
-
-		(*journal_iter) = &j->journals[i].public;
-
-		r = thunk_dispatch(closure);
-		if (r < 0)
-			return r;
-	}
-
-	thunk_free(closure);
-
-	return 0;
+	return journals_open_next(j);
 }
 
 
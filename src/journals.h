@@ -1,7 +1,10 @@
 #ifndef _JIO_JOURNALS_H
 #define _JIO_JOURNALS_H
 
+#include <endian.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <time.h>
 
 /* open() includes since journals_open() reuses open() flags */
 #include <sys/types.h>
@@ -15,30 +18,148 @@
 
 typedef struct iou_t iou_t;
 typedef struct journals_t journals_t;
+typedef struct journal_hash_chunks_t journal_hash_chunks_t;
 
 typedef struct journal_t {
 	char		*name;
 	int		fd, idx;
+
+	/* metadata from statx() when opened */
+	uint64_t	size, blocks, ino;
+	struct timespec	mtime;
 } journal_t;
 
+typedef enum journal_backend_t {
+	JOURNAL_BACKEND_IOU,		/* journal_read() via io_uring through a shared buffer cache */
+	JOURNAL_BACKEND_MMAP,		/* journal_read() copies from a read-only mapping of each journal */
+} journal_backend_t;
+
+/* tunables, set before journals_open() */
+typedef struct journals_config_t {
+	journal_backend_t	backend;
+	uint64_t		cache_size;	/* bytes of buffer cache shared by all journals */
+	uint64_t		readahead;	/* bytes of reads kept in flight ahead of journal_iter_next_object(), 0 disables */
+	int			cache_neutral;	/* read journals O_DIRECT, or drop what was scanned from the page cache */
+	char			**paths;	/* journal directories, files, or glob patterns to open, defaults used when empty */
+	unsigned		n_paths;
+	unsigned		window;		/* journals open at once, 0 for a default bounded by RLIMIT_NOFILE */
+	unsigned		queue_depth;	/* journal I/O in flight at once, 0 for unlimited */
+	unsigned		device_queue_depth;	/* journal I/O in flight at once per device, 0 for unlimited */
+	unsigned		device_streams;	/* journals scanned at once per device, 0 for 2 on rotational devices and unlimited otherwise */
+	unsigned		jobs;		/* threads scanning journals, each with its own ring, cache and queue depth, see jobs_run() */
+	unsigned		splits;		/* ranges a journal may be split into for scanning at once, see journal_get_split_points() */
+} journals_config_t;
+
+extern journals_config_t	journals_config;
+
+/* a read-only view borrowed via journal_borrow(), see journal_view_release() */
+typedef struct journal_view_t {
+	union {
+		const void	*data;
+		const Object	*object;	/* raw little-endian object, use the accessors below */
+	};
+	uint64_t	offset, length;
+
+	/* private */
+	void		(*unpin)(void *pin);
+	void		*pin;
+	journal_t	*journal;
+} journal_view_t;
+
+/* accessors for borrowed views of raw objects, these perform the le64toh()
+ * normalization the journal_get_object*() loaders perform up-front, but only
+ * on what's actually accessed.
+ */
+static inline uint64_t journal_view_object_size(const journal_view_t *view)
+{
+	return le64toh(view->object->object.size);
+}
+
+/* data and field objects share the HashedObjectHeader layout */
+static inline uint64_t journal_view_hash(const journal_view_t *view)
+{
+	return le64toh(view->object->data.hashed.hash);
+}
+
+static inline uint64_t journal_view_next_hash_offset(const journal_view_t *view)
+{
+	return le64toh(view->object->data.hashed.next_hash_offset);
+}
+
+static inline uint64_t journal_view_entry_array_n_items(const journal_view_t *view)
+{
+	return (journal_view_object_size(view) - offsetof(EntryArrayObject, items)) / sizeof(le64_t);
+}
+
+static inline uint64_t journal_view_entry_array_item(const journal_view_t *view, uint64_t i)
+{
+	return le64toh(view->object->entry_array.items[i]);
+}
+
+/* state of streaming a hash table, see journal_hash_table_stream_next_object() */
+typedef struct journal_hash_stream_t {
+	uint64_t		table_offset, table_size;	/* of the hash table, set before starting */
+	uint64_t		bucket, offset;			/* of the current object, offset is 0 when finished */
+
+	/* private */
+	journal_hash_chunks_t	*chunks;
+} journal_hash_stream_t;
+
+/* most objects delivered at once by journal_iter_object_batches() */
+#define JOURNAL_BATCH_OBJECTS	4096
+
+/* an object found by journal_iter_object_batches(), size is host-endian */
+typedef struct journal_object_ref_t {
+	uint64_t	offset, size;
+	uint8_t		type, flags;
+} journal_object_ref_t;
+
+/* state of a batched object iteration, see journal_iter_object_batches() */
+typedef struct journal_object_batch_t {
+	journal_object_ref_t	objects[JOURNAL_BATCH_OBJECTS];
+	size_t			n_objects;	/* in objects[], 0 when finished */
+
+	/* private */
+	uint64_t		offset;		/* of the next object header */
+	uint64_t		end;		/* of the range being iterated */
+	unsigned		whole:1;	/* iterating the whole journal */
+	journal_view_t		view;
+} journal_object_batch_t;
+
+/* the bucket of a hash table of table_size bytes a hash maps to */
+static inline uint64_t journal_hash_bucket(uint64_t hash, uint64_t table_size)
+{
+	return hash % (table_size / sizeof(HashItem));
+}
+
 THUNK_DECLARE(journals_open, iou_t *, iou, char **, machid, int, flags, journals_t **, journals, thunk_t *, closure);
 THUNK_DECLARE(journal_get_header, iou_t *, iou, journal_t **, journal, Header *, header, thunk_t *, closure);
 
 THUNK_DECLARE(journal_iter_next_object, iou_t *, iou, journal_t **, journal, Header *, header, uint64_t *, iter_offset, ObjectHeader *, iter_object_header, thunk_t *, closure);
 THUNK_DECLARE(journal_iter_objects, iou_t *, iou, journal_t **, journal, Header *, header, uint64_t *, iter_offset, ObjectHeader *, iter_object_header, thunk_t *, closure);
+THUNK_DECLARE(journal_iter_object_batches, iou_t *, iou, journal_t **, journal, Header *, header, journal_object_batch_t *, batch, thunk_t *, closure);
+THUNK_DECLARE(journal_iter_object_range, iou_t *, iou, journal_t **, journal, Header *, header, uint64_t, start, uint64_t, end, journal_object_batch_t *, batch, thunk_t *, closure);
+THUNK_DECLARE(journal_get_split_points, iou_t *, iou, journal_t **, journal, Header *, header, uint64_t *, points, unsigned *, n_ranges, thunk_t *, closure);
 
 THUNK_DECLARE(journal_get_hash_table, iou_t *, iou, journal_t **, journal, uint64_t *, hash_table_offset, uint64_t *, hash_table_size, HashItem **, res_hash_table, thunk_t *, closure);
 THUNK_DECLARE(journal_hash_table_iter_next_object, iou_t *, iou, journal_t **, journal, HashItem **, hash_table, uint64_t *, hash_table_size, uint64_t *, iter_bucket, uint64_t *, iter_offset, HashedObjectHeader *, iter_object_header, size_t, iter_object_size, thunk_t *, closure);
 THUNK_DECLARE(journal_hash_table_for_each, iou_t *, iou, journal_t **, journal, HashItem **, hash_table, uint64_t *, hash_table_size, uint64_t *, iter_bucket, uint64_t *, iter_offset, HashedObjectHeader *, iter_object_header, size_t, iter_object_size, thunk_t *, closure);
+THUNK_DECLARE(journal_hash_table_stream_next_object, iou_t *, iou, journal_t **, journal, journal_hash_stream_t *, stream, HashedObjectHeader *, iter_object_header, size_t, iter_object_size, thunk_t *, closure);
+THUNK_DECLARE(journal_hash_table_for_each_parallel, iou_t *, iou, journal_t **, journal, HashItem **, hash_table, uint64_t *, hash_table_size, unsigned, n_chains, size_t, iter_object_size, uint64_t *, iter_bucket, uint64_t *, iter_offset, HashedObjectHeader **, iter_object, thunk_t *, closure);
 
 THUNK_DECLARE(journal_get_object_header, iou_t *, iou, journal_t **, journal, uint64_t *, offset, ObjectHeader *, object_header, thunk_t *, closure);
 THUNK_DECLARE(journal_get_object, iou_t *, iou, journal_t **, journal, uint64_t *, offset, uint64_t *, size, Object **, object, thunk_t *, closure);
 THUNK_DECLARE(journal_get_object_full, iou_t *, iou, journal_t **, journal, uint64_t *, offset, ObjectHeader *, object_header, Object **, object, thunk_t *, closure);
+THUNK_DECLARE(journal_borrow_object, iou_t *, iou, journal_t **, journal, uint64_t *, offset, journal_view_t *, view, thunk_t *, closure);
 THUNK_DECLARE(journals_for_each, journals_t **, journals, journal_t **, journal_iter, thunk_t *, closure);
 
 const char * journal_object_type_str(ObjectType type);
 const char * journal_state_str(JournalState state);
 
 int journal_read(iou_t *iou, journal_t *journal, uint64_t offset, uint64_t length, void *dest, thunk_t *closure);
+int journal_borrow(iou_t *iou, journal_t *journal, uint64_t offset, uint64_t length, journal_view_t *view, thunk_t *closure);
+void journal_view_release(journal_view_t *view);
+void journal_on_abandon(journal_t *journal, thunk_t *closure);
+void journals_pool_free(void);
 
 #endif
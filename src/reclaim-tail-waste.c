@@ -44,8 +44,6 @@ typedef struct tail_waste_t {
 THUNK_DEFINE_STATIC(reclaim_tail_waste, journal_t **, journal, Header *, journal_header, ObjectHeader *, tail_object_header, tail_waste_t *, tail_waste)
 {
 	uint64_t	sz, tail;
-	struct stat	st;
-	int		r;
 	humane_t	h1;
 
 	assert(journal);
@@ -53,13 +51,9 @@ THUNK_DEFINE_STATIC(reclaim_tail_waste, journal_t **, journal, Header *, journal
 	assert(tail_object_header);
 	assert(tail_waste);
 
-	r = fstat((*journal)->fd, &st);
-	if (r < 0)
-		return r;
-
 	tail_waste->n_journals++;
 
-	sz = st.st_size;
+	sz = (*journal)->size;
 	tail = journal_header->tail_object_offset + ALIGN64(tail_object_header->size);
 
 	if (sz == tail) {
@@ -92,6 +86,8 @@ THUNK_DEFINE_STATIC(reclaim_tail_waste, journal_t **, journal, Header *, journal
 		return 0;
 	}
 
+	(*journal)->size = tail;
+
 	tail_waste->n_reclaimed++;
 	tail_waste->reclaimed_bytes += sz - tail;
 
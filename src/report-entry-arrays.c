@@ -39,12 +39,14 @@
 #include <inttypes.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #include <iou.h>
 #include <openssl/sha.h>
 #include <thunk.h>
 
 #include "humane.h"
+#include "jobs.h"
 #include "journals.h"
 #include "machid.h"
 #include "op.h"
@@ -77,19 +79,24 @@ typedef struct entry_array_stats_t {
 } entry_array_stats_t;
 
 
-THUNK_DEFINE_STATIC(per_entry_array_payload, iou_t *, iou, uint64_t, payload_size, char *, payload_buf, entry_array_profile_t *, profile, thunk_t *, closure)
+/* One per_entry_array_payload() closure serves every entry array of a journal,
+ * resuming the iteration with next itself instead of via a per-object closure.
+ */
+THUNK_DEFINE_STATIC(per_entry_array_payload, iou_t *, iou, journal_t **, journal, Header *, header, uint64_t *, iter_offset, ObjectHeader *, iter_object_header, journal_view_t *, payload_view, entry_array_profile_t *, profile, thunk_t *, next)
 {
 	unsigned char	digest[SHA_DIGEST_LENGTH];
 	int		bucket = 0;
+	uint64_t	payload_size;
 	SHA_CTX		ctx;
 	entry_array_t	*ea;
 
 	assert(iou);
-	assert(payload_size);
-	assert(payload_buf);
+	assert(payload_view && payload_view->data);
+
+	payload_size = payload_view->length;
 
 	SHA1_Init(&ctx);
-	SHA1_Update(&ctx, payload_buf, payload_size);
+	SHA1_Update(&ctx, payload_view->data, payload_size);
 	SHA1_Final(digest, &ctx);
 
 	/* this is a cheesy way to turn the digest into a bucket id */
@@ -109,7 +116,8 @@ THUNK_DEFINE_STATIC(per_entry_array_payload, iou_t *, iou, uint64_t, payload_siz
 			return -ENOMEM;
 
 		{
-			le64_t	*items = (le64_t *)payload_buf, utilized = 0;
+			const le64_t	*items = payload_view->data;
+			uint64_t	utilized = 0;
 
 			for (int i = 0; i < payload_size / sizeof(le64_t); i++) {
 				if (items[i])
@@ -128,9 +136,9 @@ THUNK_DEFINE_STATIC(per_entry_array_payload, iou_t *, iou, uint64_t, payload_siz
 
 	ea->count++;
 
-	free(payload_buf);
+	journal_view_release(payload_view);
 
-	return thunk_end(thunk_dispatch(closure));
+	return thunk_mid(journal_iter_next_object(iou, journal, header, iter_offset, iter_object_header, next));
 }
 
 
@@ -212,7 +220,7 @@ static void add_stats(entry_array_stats_t *dest, const entry_array_stats_t *src)
 }
 
 
-THUNK_DEFINE_STATIC(per_object, thunk_t *, self, uint64_t *, iter_offset, ObjectHeader *, iter_object_header, iou_t *, iou, journal_t **, journal, Header *, header, entry_array_profile_t *, profile, entry_array_stats_t *, totals)
+THUNK_DEFINE_STATIC(per_object, thunk_t *, self, uint64_t *, iter_offset, ObjectHeader *, iter_object_header, journal_view_t *, payload_view, iou_t *, iou, journal_t **, journal, Header *, header, entry_array_profile_t *, profile, entry_array_stats_t *, totals, thunk_t **, payload)
 {
 	assert(self);
 	assert(iter_offset);
@@ -241,10 +249,16 @@ THUNK_DEFINE_STATIC(per_object, thunk_t *, self, uint64_t *, iter_offset, Object
 			}
 		}
 
+		/* keep concurrent jobs from interleaving their journals' stats */
+		flockfile(stdout);
 		printf("\n\nEntry-array stats for \"%s\":\n", (*journal)->name);
 		print_stats(&stats);
+		funlockfile(stdout);
 		add_stats(totals, &stats);
 
+		thunk_free(*payload);
+		*payload = NULL;
+
 		return 0;
 	}
 
@@ -254,21 +268,10 @@ THUNK_DEFINE_STATIC(per_object, thunk_t *, self, uint64_t *, iter_offset, Object
 
 	profile->count++;
 
-	/* We need to load the actual entry array payload so we can hash it for
-	 * counting duplicates, so allocate space for that and queue the op.
+	/* We need to look at the actual entry array payload so we can hash it for
+	 * counting duplicates, so borrow a view of it and queue the op.
 	 */
-	{
-		size_t	payload_size = iter_object_header->size - offsetof(EntryArrayObject, items);
-		char	*buf;
-
-		buf = malloc(payload_size);
-		if (!buf)
-			return -ENOMEM;
-
-		return	thunk_mid(journal_read(iou, *journal, (*iter_offset) + offsetof(EntryArrayObject, items), payload_size, buf, THUNK(
-				per_entry_array_payload(iou, payload_size, buf, profile, THUNK(
-					journal_iter_next_object(iou, journal, header, iter_offset, iter_object_header, self))))));
-	}
+	return	thunk_mid(journal_borrow(iou, *journal, (*iter_offset) + offsetof(EntryArrayObject, items), iter_object_header->size - offsetof(EntryArrayObject, items), payload_view, *payload));
 }
 
 
@@ -279,7 +282,9 @@ THUNK_DEFINE_STATIC(per_journal, iou_t *, iou, journal_t **, journal_iter, entry
 		Header			header;
 		uint64_t		iter_offset;
 		ObjectHeader		iter_object_header;
+		journal_view_t		payload_view;
 		entry_array_profile_t	profile;
+		thunk_t			*payload;
 	} *foo;
 
 	thunk_t	*closure;
@@ -289,26 +294,30 @@ THUNK_DEFINE_STATIC(per_journal, iou_t *, iou, journal_t **, journal_iter, entry
 
 	closure = THUNK_ALLOC(per_object, (void **)&foo, sizeof(*foo));
 	foo->journal = *journal_iter;
+	foo->payload = THUNK(per_entry_array_payload(iou, &foo->journal, &foo->header, &foo->iter_offset, &foo->iter_object_header, &foo->payload_view, &foo->profile, closure));
+	if (!foo->payload) {
+		thunk_free(closure);
+		return -ENOMEM;
+	}
 
 	return journal_get_header(iou, &foo->journal, &foo->header, THUNK(
 			journal_iter_next_object(iou, &foo->journal, &foo->header, &foo->iter_offset, &foo->iter_object_header, THUNK_INIT(
-				per_object(closure, closure, &foo->iter_offset, &foo->iter_object_header, iou, &foo->journal, &foo->header, &foo->profile, totals)))));
+				per_object(closure, closure, &foo->iter_offset, &foo->iter_object_header, &foo->payload_view, iou, &foo->journal, &foo->header, &foo->profile, totals, &foo->payload)))));
 }
 
 
-/* print stats about entry arrays per journal */
-int jio_report_entry_arrays(iou_t *iou, int argc, char *argv[])
+static int entry_arrays_job(iou_t *iou, void *arg)
 {
+	entry_array_stats_t	*totals = arg;
 	char			*machid;
 	journals_t		*journals;
 	journal_t		*journal_iter;
 	int			r;
-	entry_array_stats_t	totals = {};
 
 	r = machid_get(iou, &machid, THUNK(
 		journals_open(iou, &machid, O_RDONLY, &journals, THUNK(
 			journals_for_each(&journals, &journal_iter, THUNK(
-				per_journal(iou, &journal_iter, &totals)))))));
+				per_journal(iou, &journal_iter, totals)))))));
 	if (r < 0)
 		return r;
 
@@ -316,6 +325,31 @@ int jio_report_entry_arrays(iou_t *iou, int argc, char *argv[])
 	if (r < 0)
 		return r;
 
+	return 0;
+}
+
+
+/* print stats about entry arrays per journal */
+int jio_report_entry_arrays(iou_t *iou, int argc, char *argv[])
+{
+	int			r;
+	entry_array_stats_t	totals = {}, *jobs;
+
+	/* per-job totals, merged once all the jobs are done */
+	jobs = calloc(journals_config.jobs, sizeof(*jobs));
+	if (!jobs)
+		return -ENOMEM;
+
+	r = jobs_run(iou, journals_config.jobs, entry_arrays_job, jobs, sizeof(*jobs));
+	if (r < 0) {
+		free(jobs);
+		return r;
+	}
+
+	for (unsigned i = 0; i < journals_config.jobs; i++)
+		add_stats(&totals, &jobs[i]);
+	free(jobs);
+
 	printf("\n\nEntry-array aggregate totals for all journals\n");
 	print_stats(&totals);
 
@@ -19,10 +19,12 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdio_ext.h>
+#include <string.h>
 
 #include <iou.h>
 #include <thunk.h>
 
+#include "jobs.h"
 #include "journals.h"
 #include "machid.h"
 #include "report-layout.h"
@@ -44,27 +46,16 @@ static const char type_map[_OBJECT_TYPE_MAX] = {
 /* TODO: this should be either argv settable or just determined at runtime */
 #define PAGE_SIZE 4096
 
-THUNK_DEFINE_STATIC(per_data_object, uint64_t *, iter_offset, ObjectHeader *, iter_object_header, FILE *, out)
+static void print_object(const journal_object_ref_t *object, FILE *out)
 {
 	char		boundary_marker[22] = "";
 	char		alignment_marker[3] = "";
 	uint64_t	off, this_page, next_page, page_delta, aligned_delta;
 
-	assert(iter_offset);
-	assert(iter_object_header);
-	assert(out);
-
-	off = *iter_offset;
-
-	if (!off) {
-		fprintf(out, "\n");
-		fclose(out);
-		return 0;
-	}
-
+	off = object->offset;
 
 	this_page = off & ~(PAGE_SIZE-1);
-	next_page = (off + iter_object_header->size + PAGE_SIZE-1) & ~(PAGE_SIZE-1);
+	next_page = (off + object->size + PAGE_SIZE-1) & ~(PAGE_SIZE-1);
 	page_delta = next_page - this_page;
 
 	if (page_delta > PAGE_SIZE * 2)
@@ -72,7 +63,7 @@ THUNK_DEFINE_STATIC(per_data_object, uint64_t *, iter_offset, ObjectHeader *, it
 	else if (page_delta > PAGE_SIZE)
 		snprintf(boundary_marker, sizeof(boundary_marker), "|");
 
-	aligned_delta = ALIGN64(iter_object_header->size) - iter_object_header->size;
+	aligned_delta = ALIGN64(object->size) - object->size;
 
 	if (aligned_delta > 1)
 		snprintf(alignment_marker, sizeof(alignment_marker), "+%"PRIu64, aligned_delta);
@@ -81,37 +72,81 @@ THUNK_DEFINE_STATIC(per_data_object, uint64_t *, iter_offset, ObjectHeader *, it
 
 	fprintf(out, "%s%c%s%"PRIu64"%s ",
 		this_page == off ? "| " : "",
-		type_map[iter_object_header->type],
+		type_map[object->type],
 		boundary_marker,
-		iter_object_header->size,
+		object->size,
 		alignment_marker);
+}
+
+
+THUNK_DEFINE_STATIC(per_object_batch, journal_t **, journal, journal_object_batch_t *, batch, FILE *, out)
+{
+	assert(journal);
+	assert(batch);
+	assert(out);
+
+	if (!batch->n_objects) {
+		journal_on_abandon(*journal, NULL);
+		fprintf(out, "\n");
+		fclose(out);
+		return 0;
+	}
+
+	for (size_t i = 0; i < batch->n_objects; i++)
+		print_object(&batch->objects[i], out);
 
 	return 1;
 }
 
 
+/* the journal was abandoned as invalid, its layout only goes as far as it got */
+THUNK_DEFINE_STATIC(layout_abandoned, thunk_t *, closure, FILE *, out)
+{
+	assert(closure);
+	assert(out);
+
+	fprintf(out, "\nAbandoned as invalid\n");
+	fclose(out);
+	thunk_free(closure);
+
+	return 0;
+}
+
+
 THUNK_DEFINE_STATIC(per_journal, iou_t *, iou, journal_t **, journal_iter)
 {
 	struct {
-		journal_t	*journal;
-		Header		header;
-		uint64_t	iter_offset;
-		ObjectHeader	iter_object_header;
-		FILE		*out;
+		journal_t		*journal;
+		Header			header;
+		journal_object_batch_t	batch;
+		FILE			*out;
 	} *foo;
 
 	thunk_t		*closure;
+	const char	*name;
 	char		*fname;
 	FILE		*f;
 
 	assert(iou);
 	assert(journal_iter);
 
-	fname = malloc(strlen((*journal_iter)->name) + sizeof(".layout"));
+	/* journal names are paths, the .layout files go in the cwd named after
+	 * the whole path with '/' mapped to '_', as the same basenames turn up
+	 * in every journal directory.
+	 */
+	name = (*journal_iter)->name;
+	while (*name == '/')
+		name++;
+
+	fname = malloc(strlen(name) + sizeof(".layout"));
 	if (!fname)
 		return -ENOMEM;
 
-	sprintf(fname, "%s.layout", (*journal_iter)->name);
+	sprintf(fname, "%s.layout", name);
+	for (char *c = fname; *c; c++) {
+		if (*c == '/')
+			*c = '_';
+	}
 	f = fopen(fname, "w+");
 	free(fname);
 	if (!f)
@@ -145,18 +180,19 @@ THUNK_DEFINE_STATIC(per_journal, iou_t *, iou, journal_t **, journal_iter)
 		type_map[OBJECT_TAG],
 		PAGE_SIZE);
 
-	closure = THUNK_ALLOC(per_data_object, (void **)&foo, sizeof(*foo));
+	closure = THUNK_ALLOC(per_object_batch, (void **)&foo, sizeof(*foo));
 	foo->journal = *journal_iter;
 	foo->out = f;
 
+	journal_on_abandon(*journal_iter, THUNK(layout_abandoned(closure, f)));
+
 	return thunk_mid(journal_get_header(iou, &foo->journal, &foo->header, THUNK(
-			journal_iter_objects(iou, &foo->journal, &foo->header, &foo->iter_offset, &foo->iter_object_header, THUNK_INIT(
-				per_data_object(closure, &foo->iter_offset, &foo->iter_object_header, foo->out))))));
+			journal_iter_object_batches(iou, &foo->journal, &foo->header, &foo->batch, THUNK_INIT(
+				per_object_batch(closure, &foo->journal, &foo->batch, foo->out))))));
 }
 
 
-/* print the layout of contents per journal */
-int jio_report_layout(iou_t *iou, int argc, char *argv[])
+static int layout_job(iou_t *iou, void *arg)
 {
 	char		*machid;
 	journals_t	*journals;
@@ -176,3 +212,10 @@ int jio_report_layout(iou_t *iou, int argc, char *argv[])
 
 	return 0;
 }
+
+
+/* print the layout of contents per journal */
+int jio_report_layout(iou_t *iou, int argc, char *argv[])
+{
+	return jobs_run(iou, journals_config.jobs, layout_job, NULL, 0);
+}
@@ -18,12 +18,14 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
 
 #include <iou.h>
 #include <thunk.h>
 
 #include "bootid.h"
 #include "humane.h"
+#include "jobs.h"
 #include "journals.h"
 #include "machid.h"
 #include "report-tail-waste.h"
@@ -42,8 +44,6 @@ typedef struct tail_waste_t {
 THUNK_DEFINE_STATIC(print_tail_waste, journal_t **, journal, Header *, journal_header, ObjectHeader *, tail_object_header, tail_waste_t *, tail_waste)
 {
 	uint64_t	sz, tail;
-	struct stat	st;
-	int		r;
 	humane_t	h1, h2;
 
 	assert(journal);
@@ -51,11 +51,7 @@ THUNK_DEFINE_STATIC(print_tail_waste, journal_t **, journal, Header *, journal_h
 	assert(tail_object_header);
 	assert(tail_waste);
 
-	r = fstat((*journal)->fd, &st);
-	if (r < 0)
-		return r;
-
-	sz = st.st_size;
+	sz = (*journal)->size;
 	tail = journal_header->tail_object_offset + ALIGN64(tail_object_header->size);
 
 	printf("\t%s: %s, size: %s, tail-waste: %s\n",
@@ -96,28 +92,59 @@ THUNK_DEFINE_STATIC(per_journal_tail_waste, iou_t *, iou, journal_t **, journal_
 }
 
 
-/* print the size of wasted space between each journal's tail object and EOF, and a sum total. */
-int jio_report_tail_waste(iou_t *iou, int argc, char *argv[])
+static int tail_waste_job(iou_t *iou, void *arg)
 {
-	tail_waste_t	tail_waste = {};
+	tail_waste_t	*tail_waste = arg;
 	char		*machid;
 	journals_t	*journals;
 	journal_t	*journal_iter;
-	humane_t	h1, h2;
 	int		r;
 
 	r = machid_get(iou, &machid, THUNK(
 		journals_open(iou, &machid, O_RDONLY, &journals, THUNK(
 			journals_for_each(&journals, &journal_iter, THUNK(
-				per_journal_tail_waste(iou, &journal_iter, &tail_waste)))))));
+				per_journal_tail_waste(iou, &journal_iter, tail_waste)))))));
 	if (r < 0)
 		return r;
 
-	printf("\nPer-journal:\n");
 	r = iou_run(iou);
 	if (r < 0)
 		return r;
 
+	return 0;
+}
+
+
+/* print the size of wasted space between each journal's tail object and EOF, and a sum total. */
+int jio_report_tail_waste(iou_t *iou, int argc, char *argv[])
+{
+	tail_waste_t	tail_waste = {}, *jobs;
+	humane_t	h1, h2;
+	int		r;
+
+	/* per-job tail waste, merged once all the jobs are done */
+	jobs = calloc(journals_config.jobs, sizeof(*jobs));
+	if (!jobs)
+		return -ENOMEM;
+
+	printf("\nPer-journal:\n");
+	r = jobs_run(iou, journals_config.jobs, tail_waste_job, jobs, sizeof(*jobs));
+	if (r < 0) {
+		free(jobs);
+		return r;
+	}
+
+	for (unsigned i = 0; i < journals_config.jobs; i++) {
+		for (int j = 0; j < _STATE_MAX; j++) {
+			tail_waste.per_state_counts[j] += jobs[i].per_state_counts[j];
+			tail_waste.per_state_bytes[j] += jobs[i].per_state_bytes[j];
+		}
+		tail_waste.total += jobs[i].total;
+		tail_waste.total_file_size += jobs[i].total_file_size;
+		tail_waste.n_journals += jobs[i].n_journals;
+	}
+	free(jobs);
+
 	printf("\nTotals:\n");
 	printf("\tTail-waste by state:\n");
 	for (int i = 0; i < _STATE_MAX; i++) {
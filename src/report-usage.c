@@ -18,12 +18,14 @@
 #include <inttypes.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #include <iou.h>
 #include <thunk.h>
 
 #include "bootid.h"
 #include "humane.h"
+#include "jobs.h"
 #include "journals.h"
 #include "machid.h"
 #include "report-usage.h"
@@ -39,75 +41,164 @@ typedef struct usage_t {
 } usage_t;
 
 
-THUNK_DEFINE_STATIC(per_data_object, ObjectHeader *, iter_object_header, usage_t *, usage, usage_t *, total_usage)
+/* a journal being scanned, possibly as several ranges at once */
+typedef struct usage_journal_t {
+	journal_t	*journal;
+	Header		header;
+	usage_t		usage;
+	thunk_t		*closure;	/* start_ranges(), which this is the payload of */
+	unsigned	n_ranges, n_active;
+	int		r;		/* starting a range failed, returned by the last one to finish */
+	uint64_t	points[];
+} usage_journal_t;
+
+
+THUNK_DEFINE_STATIC(per_object_batch, journal_object_batch_t *, batch, usage_journal_t *, uj, usage_t *, total_usage)
 {
-	assert(iter_object_header);
-	assert(usage);
+	assert(batch);
+	assert(uj);
 	assert(total_usage);
 
-	usage->count_per_type[iter_object_header->type]++;
-	usage->use_per_type[iter_object_header->type] += iter_object_header->size;
-	usage->use_total += iter_object_header->size;
+	if (!batch->n_objects) {
+		int	r = 0;
+
+		if (!--uj->n_active) {
+			r = uj->r;
+			journal_on_abandon(uj->journal, NULL);
+			thunk_free(uj->closure);
+		}
+
+		return r;
+	}
+
+	for (size_t i = 0; i < batch->n_objects; i++) {
+		const journal_object_ref_t	*o = &batch->objects[i];
+
+		uj->usage.count_per_type[o->type]++;
+		uj->usage.use_per_type[o->type] += o->size;
+		uj->usage.use_total += o->size;
 
-	total_usage->count_per_type[iter_object_header->type]++;
-	total_usage->use_per_type[iter_object_header->type] += iter_object_header->size;
-	total_usage->use_total += iter_object_header->size;
+		total_usage->count_per_type[o->type]++;
+		total_usage->use_per_type[o->type] += o->size;
+		total_usage->use_total += o->size;
+	}
 
 	return 1;
 }
 
 
-THUNK_DEFINE_STATIC(per_journal, iou_t *, iou, journal_t **, journal_iter, usage_t *, total_usage, unsigned *, n_journals)
+/* iterate the journal's ranges concurrently, or just the whole journal when unsplit */
+THUNK_DEFINE_STATIC(start_ranges, thunk_t *, self, iou_t *, iou, usage_journal_t *, uj, usage_t *, total_usage)
+{
+	unsigned	n_ranges = uj->n_ranges;
+
+	uj->closure = self;
+	uj->n_active = n_ranges + 1;	/* keep uj around while still starting ranges */
+	uj->r = 0;
+
+	for (unsigned i = 0; i < n_ranges; i++) {
+		journal_object_batch_t	*batch;
+		thunk_t			*closure;
+		int			r;
+
+		closure = THUNK_ALLOC(per_object_batch, (void **)&batch, sizeof(*batch));
+		if (!closure) {
+			r = -ENOMEM;
+		} else {
+			THUNK_INIT(per_object_batch(closure, batch, uj, total_usage));
+
+			if (n_ranges == 1)
+				r = journal_iter_object_batches(iou, &uj->journal, &uj->header, batch, closure);
+			else
+				r = journal_iter_object_range(iou, &uj->journal, &uj->header, uj->points[i], uj->points[i + 1], batch, closure);
+		}
+
+		if (r < 0) {
+			/* this range and those after it won't be finishing, the ones in flight still hold uj */
+			uj->n_active -= n_ranges - i;
+			uj->r = r;
+			break;
+		}
+	}
+
+	if (!--uj->n_active) {
+		journal_on_abandon(uj->journal, NULL);
+		return uj->r;
+	}
+
+	return 1;
+}
+
+
+/* the journal was abandoned as invalid, take back what it contributed to the totals */
+THUNK_DEFINE_STATIC(usage_abandoned, usage_journal_t *, uj, usage_t *, total_usage, unsigned *, n_journals)
 {
-	struct {
-		journal_t		*journal;
-		Header			header;
-		usage_t			usage;
-		uint64_t		iter_offset;
-		ObjectHeader		iter_object_header;
-	} *foo;
+	assert(uj);
+	assert(total_usage);
+	assert(n_journals);
 
+	for (int i = 0; i < _OBJECT_TYPE_MAX; i++) {
+		total_usage->count_per_type[i] -= uj->usage.count_per_type[i];
+		total_usage->use_per_type[i] -= uj->usage.use_per_type[i];
+	}
+	total_usage->use_total -= uj->usage.use_total;
+	total_usage->file_size -= uj->usage.file_size;
+	(*n_journals)--;
+
+	thunk_free(uj->closure);
+
+	return 0;
+}
+
+
+THUNK_DEFINE_STATIC(per_journal, iou_t *, iou, journal_t **, journal_iter, usage_t *, total_usage, unsigned *, n_journals)
+{
+	usage_journal_t	*uj;
 	thunk_t		*closure;
-	struct stat	st;
-	int		r;
 
 	assert(iou);
 	assert(journal_iter);
 	assert(total_usage);
 
-	/* XXX: io_uring has a STATX opcode, so this too could be async */
-	r = fstat((*journal_iter)->fd, &st);
-	if (r < 0)
-		return r;
+	closure = THUNK_ALLOC(start_ranges, (void **)&uj, sizeof(*uj) + sizeof(uint64_t) * (journals_config.splits + 1));
+	if (!closure)
+		return -ENOMEM;
 
-	closure = THUNK_ALLOC(per_data_object, (void **)&foo, sizeof(*foo));
-	foo->journal = *journal_iter;
-	foo->usage.file_size = st.st_size;
+	uj->journal = *journal_iter;
+	uj->usage = (usage_t){ .file_size = (*journal_iter)->size };
+	uj->closure = closure;
+	uj->n_ranges = journals_config.splits;
 
-	total_usage->file_size += st.st_size;
+	total_usage->file_size += (*journal_iter)->size;
 	(*n_journals)++;
 
-	return thunk_mid(journal_get_header(iou, &foo->journal, &foo->header, THUNK(
-			journal_iter_objects(iou, &foo->journal, &foo->header, &foo->iter_offset, &foo->iter_object_header, THUNK_INIT(
-				per_data_object(closure, &foo->iter_object_header, &foo->usage, total_usage))))));
+	journal_on_abandon(*journal_iter, THUNK(usage_abandoned(uj, total_usage, n_journals)));
+
+	return thunk_mid(journal_get_header(iou, &uj->journal, &uj->header, THUNK(
+			journal_get_split_points(iou, &uj->journal, &uj->header, uj->points, &uj->n_ranges, THUNK_INIT(
+				start_ranges(closure, closure, iou, uj, total_usage))))));
 }
 
 
-/* print the amount of space used by various objects per journal, and sum totals */
-int jio_report_usage(iou_t *iou, int argc, char *argv[])
+/* per-job totals, merged once all the jobs are done */
+typedef struct usage_job_t {
+	usage_t		usage;
+	unsigned	n_journals;
+} usage_job_t;
+
+
+static int usage_job(iou_t *iou, void *arg)
 {
-	usage_t		aggregate_usage = {};
+	usage_job_t	*job = arg;
 	char		*machid;
 	journals_t	*journals;
 	journal_t	*journal_iter;
-	unsigned	n_journals = 0;
-	humane_t	h1, h2;
 	int		r;
 
 	r = machid_get(iou, &machid, THUNK(
 		journals_open(iou, &machid, O_RDONLY, &journals, THUNK(
 			journals_for_each(&journals, &journal_iter, THUNK(
-				per_journal(iou, &journal_iter, &aggregate_usage, &n_journals)))))));
+				per_journal(iou, &journal_iter, &job->usage, &job->n_journals)))))));
 	if (r < 0)
 		return r;
 
@@ -115,6 +206,40 @@ int jio_report_usage(iou_t *iou, int argc, char *argv[])
 	if (r < 0)
 		return r;
 
+	return 0;
+}
+
+
+/* print the amount of space used by various objects per journal, and sum totals */
+int jio_report_usage(iou_t *iou, int argc, char *argv[])
+{
+	usage_t		aggregate_usage = {};
+	usage_job_t	*jobs;
+	unsigned	n_journals = 0;
+	humane_t	h1, h2;
+	int		r;
+
+	jobs = calloc(journals_config.jobs, sizeof(*jobs));
+	if (!jobs)
+		return -ENOMEM;
+
+	r = jobs_run(iou, journals_config.jobs, usage_job, jobs, sizeof(*jobs));
+	if (r < 0) {
+		free(jobs);
+		return r;
+	}
+
+	for (unsigned i = 0; i < journals_config.jobs; i++) {
+		for (int j = 0; j < _OBJECT_TYPE_MAX; j++) {
+			aggregate_usage.count_per_type[j] += jobs[i].usage.count_per_type[j];
+			aggregate_usage.use_per_type[j] += jobs[i].usage.use_per_type[j];
+		}
+		aggregate_usage.use_total += jobs[i].usage.use_total;
+		aggregate_usage.file_size += jobs[i].usage.file_size;
+		n_journals += jobs[i].n_journals;
+	}
+	free(jobs);
+
 	printf("Per-object-type usage:\n");
 	for (int i = 0; i < _OBJECT_TYPE_MAX; i++)
 		printf("%16s: [%"PRIu64"] %s\n",
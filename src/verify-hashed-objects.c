@@ -28,6 +28,7 @@
 #include <thunk.h>
 
 #include "humane.h"
+#include "jobs.h"
 #include "journals.h"
 #include "machid.h"
 #include "verify-hashed-objects.h"
@@ -37,19 +38,22 @@
 #include "upstream/siphash24.h"
 
 /* This simply loads all hashed objects (field and data objects) and verifies their
- * hashes against their contents.  It doesn't examine entry item hashes and verify
- * they match the referenced objects, but maybe it should do that too.  If it adds
- * that ability, it probably makes sense to rename to verify-hashes.
+ * hashes against their contents, then walks the hash tables verifying every object
+ * chained in them is in the bucket its hash maps to, so lookups can find it.  It
+ * doesn't examine entry item hashes and verify they match the referenced objects,
+ * but maybe it should do that too.  If it adds that ability, it probably makes
+ * sense to rename to verify-hashes.
  */
 
 /* just some basic counters to aid in sanity checking this thing is actually doing work */
 typedef struct verify_stats_t {
 		uint64_t	n_field_objects, n_data_objects;
 		uint64_t	n_field_bytes, n_data_bytes;
+		uint64_t	n_chained_field_objects, n_chained_data_objects;
 } verify_stats_t;
 
 /* borrowed from systemd */
-static uint64_t hash(Header *header, void *payload, uint64_t size)
+static uint64_t hash(Header *header, const void *payload, uint64_t size)
 {
 	if (header->incompatible_flags & HEADER_INCOMPATIBLE_KEYED_HASH)
 		return siphash24(payload, size, header->file_id.bytes);
@@ -70,7 +74,7 @@ static int zstd_ret_to_errno(size_t ret) {
 }
 
 
-static int decompress(int compression, void *src, uint64_t src_size, void **dest, size_t *dest_size)
+static int decompress(int compression, const void *src, uint64_t src_size, void **dest, size_t *dest_size)
 {
 	uint64_t	size;
 	ZSTD_DCtx	*dctx;
@@ -123,27 +127,27 @@ static int decompress(int compression, void *src, uint64_t src_size, void **dest
 }
 
 
-THUNK_DEFINE_STATIC(verify_hashed_object, journal_t *, journal, Header *, header, Object **, iter_object, void **, decompressed, verify_stats_t *, stats)
+THUNK_DEFINE_STATIC(verify_hashed_object, journal_t *, journal, Header *, header, journal_view_t *, iter_view, void **, decompressed, verify_stats_t *, stats)
 {
 	int		compression;
 	uint64_t	payload_size, h;
-	void		*payload;
-	Object		*o;
+	const void	*payload;
+	const Object	*o;
 
-	assert(iter_object && *iter_object);
+	assert(iter_view && iter_view->object);
 	assert(stats);
 
-	o = *iter_object;
+	o = iter_view->object;
 
 	switch (o->object.type) {
 	case OBJECT_FIELD:
-		payload_size = o->object.size - offsetof(FieldObject, payload),
+		payload_size = journal_view_object_size(iter_view) - offsetof(FieldObject, payload),
 		payload = o->field.payload;
 		stats->n_field_objects++;
 		stats->n_field_bytes += payload_size;
 		break;
 	case OBJECT_DATA:
-		payload_size = o->object.size - offsetof(DataObject, payload),
+		payload_size = journal_view_object_size(iter_view) - offsetof(DataObject, payload),
 		payload = o->data.payload;
 		stats->n_data_objects++;
 		stats->n_data_bytes += payload_size;
@@ -176,9 +180,9 @@ THUNK_DEFINE_STATIC(verify_hashed_object, journal_t *, journal, Header *, header
 		h = hash(header, payload, payload_size);
 	}
 
-	if (h != o->data.hashed.hash) {
+	if (h != journal_view_hash(iter_view)) {
 		printf("mismatch %"PRIx64" != %"PRIx64"\ncontents=\"%.*s\"\n",
-			h, o->data.hashed.hash,
+			h, journal_view_hash(iter_view),
 			(int)payload_size, payload);
 		return -EBADMSG;
 	}
@@ -187,66 +191,240 @@ THUNK_DEFINE_STATIC(verify_hashed_object, journal_t *, journal, Header *, header
 }
 
 
-THUNK_DEFINE_STATIC(per_hashed_object, iou_t *, iou, journal_t *, journal, Header *, header, Object **, iter_object, void **, decompressed, verify_stats_t *, stats, thunk_t *, closure)
+/* return the borrowed object view before continuing */
+THUNK_DEFINE_STATIC(release_view, journal_view_t *, view, thunk_t *, closure)
 {
-	assert(iter_object && *iter_object);
+	journal_view_release(view);
+
+	return thunk_end(thunk_dispatch(closure));
+}
+
+
+/* A single per_hashed_object() closure serves every hashed object of a
+ * journal, it continues the iteration itself via next rather than through
+ * a closure allocated per object.
+ */
+THUNK_DEFINE_STATIC(per_hashed_object, iou_t *, iou, journal_t **, journal, Header *, header, uint64_t *, iter_offset, ObjectHeader *, iter_object_header, journal_view_t *, iter_view, void **, decompressed, verify_stats_t *, stats, thunk_t *, next)
+{
+	assert(iter_view && iter_view->object);
 
 	/* smallish objects verify synchronously here */
-	if ((*iter_object)->object.size <= 16 * 1024) {
+	if (iter_view->length <= 16 * 1024) {
 		int	r;
 
-		r = verify_hashed_object(journal, header, iter_object, decompressed, stats);
+		r = verify_hashed_object(*journal, header, iter_view, decompressed, stats);
 		if (r < 0)
 			return r;
 
-		return thunk_end(thunk_dispatch(closure));
+		journal_view_release(iter_view);
+
+		return thunk_mid(journal_iter_next_object(iou, journal, header, iter_offset, iter_object_header, next));
 	}
 
-	/* handoff larger objects to an async worker thread, with the supplied closure for continuation @ completion */
-	return	thunk_end(iou_async(iou, (int(*)(void *))thunk_dispatch, THUNK(
-			verify_hashed_object(journal, header, iter_object, decompressed, stats)),
-				(int(*)(void *))thunk_dispatch, closure));
+	/* handoff larger objects to an async worker thread, with the supplied closure for continuation @ completion,
+	 * the view is released back on this side since the cache isn't thread-safe.
+	 */
+	return	thunk_mid(iou_async(iou, (int(*)(void *))thunk_dispatch, THUNK(
+			verify_hashed_object(*journal, header, iter_view, decompressed, stats)),
+				(int(*)(void *))thunk_dispatch, THUNK(
+					release_view(iter_view, THUNK(
+						journal_iter_next_object(iou, journal, header, iter_offset, iter_object_header, next))))));
+}
+
+
+static void report_finished(journal_t *journal, verify_stats_t *stats)
+{
+	humane_t	h1, h2;
+
+	printf("\"%s\" finished: field_objects=%"PRIu64"(%s) data_objects=%"PRIu64"(%s) chained_field_objects=%"PRIu64" chained_data_objects=%"PRIu64"\n",
+		journal->name,
+		stats->n_field_objects,
+		humane_bytes(&h1, stats->n_field_bytes),
+		stats->n_data_objects,
+		humane_bytes(&h2, stats->n_data_bytes),
+		stats->n_chained_field_objects,
+		stats->n_chained_data_objects);
+}
+
+
+/* an object found @ offset in bucket of a hash table of table_size should be of the table's type, and chained in its hash's bucket */
+static int check_chained_object(journal_t *journal, const HashedObjectHeader *o, uint64_t offset, uint64_t bucket, uint64_t table_size, ObjectType type)
+{
+	if (o->object.type != type) {
+		printf("\"%s\" has a %s object @ %"PRIu64" in its %s hash table\n",
+			journal->name,
+			journal_object_type_str(o->object.type),
+			offset,
+			journal_object_type_str(type));
+		return -EBADMSG;
+	}
+
+	if (journal_hash_bucket(o->hash, table_size) != bucket) {
+		printf("\"%s\" has an object @ %"PRIu64" with hash %"PRIx64" chained in bucket %"PRIu64" instead of %"PRIu64"\n",
+			journal->name,
+			offset,
+			o->hash,
+			bucket,
+			journal_hash_bucket(o->hash, table_size));
+		return -EBADMSG;
+	}
+
+	return 0;
+}
+
+
+/* Data objects are delivered as the chains of the data hash table being walked in parallel land */
+THUNK_DEFINE_STATIC(per_walked_object, journal_t **, journal, Header *, header, HashItem **, table, uint64_t *, bucket, uint64_t *, offset, HashedObjectHeader **, walked, verify_stats_t *, stats)
+{
+	int	r;
+
+	assert(header);
+	assert(table);
+	assert(walked);
+	assert(stats);
+
+	if (!*walked) {
+		free(*table);
+		*table = NULL;
+
+		report_finished(*journal, stats);
+		return 0;
+	}
+
+	/* no final dispatch follows an error, so clean up here */
+	r = check_chained_object(*journal, *walked, *offset, *bucket, header->data_hash_table_size, OBJECT_DATA);
+	if (r < 0) {
+		free(*table);
+		*table = NULL;
+
+		return r;
+	}
+
+	stats->n_chained_data_objects++;
+
+	return thunk_mid(0);
+}
+
+
+/* The data hash table is where nearly all the chains are, so rather than
+ * streaming it the way the field table is, it's loaded whole and its chains
+ * walked JOURNAL_HASH_CHAINS_DEFAULT at a time.
+ */
+static int verify_data_table(iou_t *iou, journal_t *journal, Header *header, verify_stats_t *stats)
+{
+	struct {
+		journal_t		*journal;
+		Header			header;
+		HashItem		*table;
+		uint64_t		bucket, offset;
+		HashedObjectHeader	*walked;
+		verify_stats_t		stats;
+	} *foo;
+
+	thunk_t		*closure;
+
+	closure = THUNK_ALLOC(per_walked_object, (void **)&foo, sizeof(*foo));
+	if (!closure)
+		return -ENOMEM;
+
+	foo->journal = journal;
+	foo->header = *header;
+	foo->table = NULL;
+	foo->walked = NULL;
+	foo->stats = *stats;
+
+	THUNK_INIT(per_walked_object(closure, &foo->journal, &foo->header, &foo->table, &foo->bucket, &foo->offset, &foo->walked, &foo->stats));
+
+	/* no data hash table, just finish */
+	if (!foo->header.data_hash_table_size)
+		return thunk_dispatch(closure);
+
+	return journal_get_hash_table(iou, &foo->journal, &foo->header.data_hash_table_offset, &foo->header.data_hash_table_size, &foo->table, THUNK(
+			journal_hash_table_for_each_parallel(iou, &foo->journal, &foo->table, &foo->header.data_hash_table_size, 0, sizeof(HashedObjectHeader), &foo->bucket, &foo->offset, &foo->walked, closure)));
 }
 
 
-THUNK_DEFINE_STATIC(per_object, thunk_t *, self, iou_t *, iou, journal_t **, journal, Header *, header, uint64_t *, iter_offset, ObjectHeader *, iter_object_header, Object **, iter_object, void **, decompressed, verify_stats_t *, stats)
+/* Field objects are streamed from the field hash table, then it's on to the data hash table */
+THUNK_DEFINE_STATIC(per_chained_object, thunk_t *, self, iou_t *, iou, journal_t **, journal, Header *, header, journal_hash_stream_t *, stream, HashedObjectHeader *, chained, verify_stats_t *, stats)
+{
+	int	r;
+
+	assert(header);
+	assert(stream);
+	assert(chained);
+	assert(stats);
+
+	if (!stream->offset)
+		return thunk_end(verify_data_table(iou, *journal, header, stats));
+
+	r = check_chained_object(*journal, chained, stream->offset, stream->bucket, stream->table_size, OBJECT_FIELD);
+	if (r < 0)
+		return r;
+
+	stats->n_chained_field_objects++;
+
+	return thunk_mid(journal_hash_table_stream_next_object(iou, journal, stream, chained, sizeof(*chained), self));
+}
+
+
+/* Once the hashed objects are all verified, walk the journal's hash tables
+ * verifying the chains, with state of its own as the sequential
+ * iteration's is freed on return.
+ */
+static int verify_hash_tables(iou_t *iou, journal_t *journal, Header *header, verify_stats_t *stats)
+{
+	struct {
+		journal_t		*journal;
+		Header			header;
+		journal_hash_stream_t	stream;
+		HashedObjectHeader	chained;
+		verify_stats_t		stats;
+	} *foo;
+
+	thunk_t		*closure;
+
+	if (!header->field_hash_table_size)
+		return verify_data_table(iou, journal, header, stats);
+
+	closure = THUNK_ALLOC(per_chained_object, (void **)&foo, sizeof(*foo));
+	if (!closure)
+		return -ENOMEM;
+
+	foo->journal = journal;
+	foo->header = *header;
+	foo->stats = *stats;
+	foo->stream.chunks = NULL;
+	foo->stream.offset = 0;
+	foo->stream.table_offset = header->field_hash_table_offset;
+	foo->stream.table_size = header->field_hash_table_size;
+
+	THUNK_INIT(per_chained_object(closure, closure, iou, &foo->journal, &foo->header, &foo->stream, &foo->chained, &foo->stats));
+
+	return journal_hash_table_stream_next_object(iou, &foo->journal, &foo->stream, &foo->chained, sizeof(foo->chained), closure);
+}
+
+
+THUNK_DEFINE_STATIC(per_object, thunk_t *, self, iou_t *, iou, journal_t **, journal, Header *, header, uint64_t *, iter_offset, ObjectHeader *, iter_object_header, journal_view_t *, iter_view, void **, decompressed, verify_stats_t *, stats, thunk_t **, hashed)
 {
 	assert(iter_offset);
 	assert(iter_object_header);
-	assert(iter_object);
+	assert(iter_view);
 	assert(stats);
 
 	if (!*iter_offset) {
-		humane_t	h1, h2;
-
-		free(*iter_object);
 		free(*decompressed);
-		*iter_object = *decompressed = NULL;
-
-		printf("\"%s\" finished: field_objects=%"PRIu64"(%s) data_objects=%"PRIu64"(%s)\n",
-			(*journal)->name,
-			stats->n_field_objects,
-			humane_bytes(&h1, stats->n_field_bytes),
-			stats->n_data_objects,
-			humane_bytes(&h2, stats->n_data_bytes));
-		return 0;
+		*decompressed = NULL;
+		thunk_free(*hashed);
+		*hashed = NULL;
+
+		return verify_hash_tables(iou, *journal, header, stats);
 	}
 
 	/* skip non-hashed objects */
 	if (iter_object_header->type != OBJECT_FIELD && iter_object_header->type != OBJECT_DATA)
 		return	thunk_mid(journal_iter_next_object(iou, journal, header, iter_offset, iter_object_header, self));
 
-	if (malloc_usable_size(*iter_object) < iter_object_header->size) {
-		free(*iter_object);
-
-		*iter_object = malloc(iter_object_header->size);
-		if (!*iter_object)
-			return -ENOMEM;
-	}
-
-	return	thunk_mid(journal_get_object(iou, journal, iter_offset, &iter_object_header->size, iter_object, THUNK(
-			per_hashed_object(iou, *journal, header, iter_object, decompressed, stats, THUNK(
-				journal_iter_next_object(iou, journal, header, iter_offset, iter_object_header, self))))));
+	return thunk_mid(journal_borrow(iou, *journal, *iter_offset, iter_object_header->size, iter_view, *hashed));
 }
 
 
@@ -257,9 +435,10 @@ THUNK_DEFINE_STATIC(per_journal, iou_t *, iou, journal_t **, journal_iter)
 		Header		header;
 		uint64_t	iter_offset;
 		ObjectHeader	iter_object_header;
-		Object		*iter_object;
+		journal_view_t	iter_view;
 		void		*decompressed;
 		verify_stats_t	stats;
+		thunk_t		*hashed;
 	} *foo;
 
 	thunk_t		*closure;
@@ -269,17 +448,22 @@ THUNK_DEFINE_STATIC(per_journal, iou_t *, iou, journal_t **, journal_iter)
 
 	closure = THUNK_ALLOC(per_object, (void **)&foo, sizeof(*foo));
 	foo->journal = *journal_iter;
-	foo->iter_object = foo->decompressed = NULL;
+	foo->decompressed = NULL;
 	foo->stats.n_field_objects = foo->stats.n_data_objects = 0;
+	foo->stats.n_chained_field_objects = foo->stats.n_chained_data_objects = 0;
+	foo->hashed = THUNK(per_hashed_object(iou, &foo->journal, &foo->header, &foo->iter_offset, &foo->iter_object_header, &foo->iter_view, &foo->decompressed, &foo->stats, closure));
+	if (!foo->hashed) {
+		thunk_free(closure);
+		return -ENOMEM;
+	}
 
 	return thunk_mid(journal_get_header(iou, &foo->journal, &foo->header, THUNK(
 			journal_iter_next_object(iou, &foo->journal, &foo->header, &foo->iter_offset, &foo->iter_object_header, THUNK_INIT(
-					per_object(closure, closure, iou, &foo->journal, &foo->header, &foo->iter_offset, &foo->iter_object_header, &foo->iter_object, &foo->decompressed, &foo->stats))))));
+					per_object(closure, closure, iou, &foo->journal, &foo->header, &foo->iter_offset, &foo->iter_object_header, &foo->iter_view, &foo->decompressed, &foo->stats, &foo->hashed))))));
 }
 
 
-/* verify the hashes of all "hashed objects" (field and data objects) */
-int jio_verify_hashed_objects(iou_t *iou, int argc, char *argv[])
+static int verify_job(iou_t *iou, void *arg)
 {
 	char		*machid;
 	journals_t	*journals;
@@ -299,3 +483,10 @@ int jio_verify_hashed_objects(iou_t *iou, int argc, char *argv[])
 
 	return 0;
 }
+
+
+/* verify the hashes of all "hashed objects" (field and data objects) */
+int jio_verify_hashed_objects(iou_t *iou, int argc, char *argv[])
+{
+	return jobs_run(iou, journals_config.jobs, verify_job, NULL, 0);
+}